@@ -0,0 +1,128 @@
+#include "util.h"
+
+static inline bool bit_get(const uint8_t *bits, uint32_t i) {
+    return (bits[i / 8] >> (i % 8)) & 1;
+}
+
+static inline void bit_set(uint8_t *bits, uint32_t i, bool value) {
+    if (value)
+        bits[i / 8] |= 1 << (i % 8);
+    else
+        bits[i / 8] &= ~(1 << (i % 8));
+}
+
+/*
+ * Reads the first frame ahead, the input has to be open.
+ */
+void arq_sender_init(struct arq_sender *arq, uint32_t window, struct transfer *in) {
+    memset(arq, 0, sizeof(*arq));
+    arq->window = window;
+    arq->next.len = transfer_read(in, arq->next.payload, FRAME_PAYLOAD_BYTES);
+}
+
+/*
+ * Fills the window with new frames from in, then collects the frames to send
+ * this round into frames: the ones not acknowledged yet, the oldest first.
+ * Returns their number, at most the window.
+ */
+uint32_t arq_sender_round(struct arq_sender *arq, struct transfer *in,
+                          const struct frame **frames) {
+    // an empty input is still sent as one (last) frame
+    while (!arq->eof && (uint16_t) (arq->next_seq - arq->base) < arq->window) {
+        struct frame *frame = &arq->frames[arq->next_seq % ARQ_MAX_WINDOW];
+        *frame = arq->next;
+        frame->seq = arq->next_seq;
+        arq->next.len = transfer_read(in, arq->next.payload, FRAME_PAYLOAD_BYTES);
+        arq->eof = arq->next.len == 0;
+        frame->flags = arq->eof? FRAME_FLAG_LAST: 0;
+        bit_set(arq->acked, arq->next_seq % ARQ_MAX_WINDOW, false);
+        arq->next_seq++;
+    }
+
+    uint32_t n = 0;
+    for (uint16_t seq = arq->base; seq != arq->next_seq; seq++) {
+        if (bit_get(arq->acked, seq % ARQ_MAX_WINDOW))
+            continue;
+        frames[n++] = &arq->frames[seq % ARQ_MAX_WINDOW];
+        if ((uint16_t) (seq - arq->base) < (uint16_t) (arq->fresh - arq->base)) {
+            arq->resent++;
+        } else {
+            arq->sent++;
+        }
+    }
+    arq->fresh = arq->next_seq;
+    return n;
+}
+
+/*
+ * Marks the frames ack acknowledges: those before its sequence number, and
+ * those after it set in the bitmap of its payload. Slides the window past
+ * the acknowledged frames.
+ */
+void arq_sender_ack(struct arq_sender *arq, const struct frame *ack) {
+    uint16_t in_flight = arq->next_seq - arq->base;
+    uint16_t ack_base = ack->seq - arq->base;
+    // a stale ACK, or one passing its CRC by chance
+    if (ack_base > in_flight)
+        return;
+
+    for (uint16_t i = 0; i < in_flight; i++) {
+        uint16_t after = i - ack_base;
+        if (i < ack_base || (after < ARQ_MAX_WINDOW && bit_get(ack->payload, after))) {
+            bit_set(arq->acked, (uint16_t) (arq->base + i) % ARQ_MAX_WINDOW, true);
+        }
+    }
+    while (arq->base != arq->next_seq && bit_get(arq->acked, arq->base % ARQ_MAX_WINDOW)) {
+        arq->base++;
+    }
+}
+
+/*
+ * Whether every frame of the input was acknowledged.
+ */
+bool arq_sender_done(const struct arq_sender *arq) {
+    return arq->eof && arq->base == arq->next_seq;
+}
+
+void arq_receiver_init(struct arq_receiver *arq) {
+    memset(arq, 0, sizeof(*arq));
+}
+
+/*
+ * Holds on to a frame that passed its CRC and hands the payloads that are
+ * now in order over to sink. Frames already delivered are only counted.
+ */
+void arq_receiver_frame(struct arq_receiver *arq, const struct frame *frame,
+                        void (*sink)(void *, const uint8_t *, size_t), void *sink_arg) {
+    uint16_t ahead = frame->seq - arq->base;
+    if (arq->done || ahead >= ARQ_MAX_WINDOW ||
+        bit_get(arq->held, frame->seq % ARQ_MAX_WINDOW)) {
+        arq->duplicates++;
+        return;
+    }
+    arq->frames[frame->seq % ARQ_MAX_WINDOW] = *frame;
+    bit_set(arq->held, frame->seq % ARQ_MAX_WINDOW, true);
+
+    while (!arq->done && bit_get(arq->held, arq->base % ARQ_MAX_WINDOW)) {
+        const struct frame *next = &arq->frames[arq->base % ARQ_MAX_WINDOW];
+        sink(sink_arg, next->payload, next->len);
+        arq->done = next->flags & FRAME_FLAG_LAST;
+        bit_set(arq->held, arq->base % ARQ_MAX_WINDOW, false);
+        arq->base++;
+        arq->delivered++;
+    }
+}
+
+/*
+ * Builds the ACK frame of the current state: the next frame needed and the
+ * bitmap of the frames held after it, flagged last once done.
+ */
+void arq_receiver_ack(const struct arq_receiver *arq, struct frame *ack) {
+    memset(ack, 0, sizeof(*ack));
+    ack->seq = arq->base;
+    ack->len = FRAME_PAYLOAD_BYTES;
+    ack->flags = FRAME_FLAG_ACK | (arq->done? FRAME_FLAG_LAST: 0);
+    for (uint32_t i = 0; i < ARQ_MAX_WINDOW; i++) {
+        bit_set(ack->payload, i, bit_get(arq->held, (uint16_t) (arq->base + i) % ARQ_MAX_WINDOW));
+    }
+}
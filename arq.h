@@ -0,0 +1,51 @@
+#ifndef ARQ_H_
+#define ARQ_H_
+
+// Included from util.h, which provides the standard headers, frame.h and transfer.h.
+
+/*
+ * Selective-repeat ARQ over time-division duplex. The transfer runs in
+ * rounds on the slot schedule: up to a window of frames from the sender,
+ * a few idle slots, an ACK frame from the receiver over the reverse regions,
+ * and idle slots again. The ACK carries the next frame the receiver needs in
+ * its sequence number and a bitmap of the frames after it that it holds, so
+ * the sender only resends the frames that were lost.
+ */
+#define ARQ_MAX_WINDOW          256     // frames in flight, as many as the ACK bitmap holds
+#define ARQ_DEFAULT_WINDOW      8
+#define ARQ_TURNAROUND_SLOTS    4       // idle slots before and after the ACK frame
+#define ARQ_MAX_SILENT_ROUNDS   16      // rounds without hearing the peer before giving up
+#define ARQ_LINGER_ROUNDS       4       // rounds the receiver keeps acknowledging once done
+
+struct arq_sender {
+    uint16_t base;                      // oldest frame not acknowledged
+    uint16_t next_seq;                  // next frame to read from the input
+    uint16_t fresh;                     // first frame never sent
+    uint32_t window;
+    bool eof;                           // the last frame was read
+    struct frame next;                  // read ahead to flag the last frame
+    uint8_t acked[ARQ_MAX_WINDOW / 8];  // by seq % ARQ_MAX_WINDOW
+    struct frame frames[ARQ_MAX_WINDOW];
+    uint32_t sent, resent;
+};
+
+struct arq_receiver {
+    uint16_t base;                      // next frame to deliver
+    bool done;                          // the last frame was delivered
+    uint8_t held[ARQ_MAX_WINDOW / 8];   // by seq % ARQ_MAX_WINDOW
+    struct frame frames[ARQ_MAX_WINDOW];
+    uint32_t delivered, duplicates;
+};
+
+void arq_sender_init(struct arq_sender *arq, uint32_t window, struct transfer *in);
+uint32_t arq_sender_round(struct arq_sender *arq, struct transfer *in,
+                          const struct frame **frames);
+void arq_sender_ack(struct arq_sender *arq, const struct frame *ack);
+bool arq_sender_done(const struct arq_sender *arq);
+
+void arq_receiver_init(struct arq_receiver *arq);
+void arq_receiver_frame(struct arq_receiver *arq, const struct frame *frame,
+                        void (*sink)(void *, const uint8_t *, size_t), void *sink_arg);
+void arq_receiver_ack(const struct arq_receiver *arq, struct frame *ack);
+
+#endif
@@ -0,0 +1,46 @@
+#include "util.h"
+
+/*
+ * Maps the benchmark shared memory called name, creating it (zeroed)
+ * when create is set.
+ */
+struct bench_shm *bench_shm_open(const char *name, bool create)
+{
+    int fd = shm_open(name, create? O_RDWR | O_CREAT | O_TRUNC: O_RDWR, 0600);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: failed to open shared memory %s: %s\n", name, strerror(errno));
+        exit(-1);
+    }
+    if (create && ftruncate(fd, sizeof(struct bench_shm)) == -1) {
+        fprintf(stderr, "ERROR: failed to size shared memory %s\n", name);
+        exit(-1);
+    }
+
+    struct bench_shm *shm = mmap(NULL, sizeof(struct bench_shm), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        fprintf(stderr, "ERROR: failed to map shared memory %s\n", name);
+        exit(-1);
+    }
+    return shm;
+}
+
+void bench_shm_close(struct bench_shm *shm)
+{
+    munmap(shm, sizeof(struct bench_shm));
+}
+
+/*
+ * Returns the raw bits of a benchmark run, whole symbols of symbol_bits up to
+ * what ccbench asked for through shm (if any).
+ */
+uint32_t bench_run_bits(const struct bench_shm *shm, uint32_t symbol_bits)
+{
+    uint32_t bits = BENCH_MAX_BITS;
+    if (shm && shm->max_bits && shm->max_bits < bits) {
+        bits = shm->max_bits;
+    }
+    bits = bits / symbol_bits * symbol_bits;
+    return bits? bits: symbol_bits;
+}
@@ -0,0 +1,31 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+// Included from util.h, which provides the standard headers.
+
+/*
+ * Shared memory through which ccbench collects the bits of a benchmark run
+ * from its sender and receiver workers (-B name), instead of text files.
+ */
+#define BENCH_MAX_BITS          8192
+
+struct bench_shm {
+    volatile uint32_t receiver_ready;   // hunting for the preamble
+    volatile uint32_t sender_done;
+    volatile uint32_t receiver_done;
+    uint32_t max_bits;                  // run length asked by ccbench, 0 for all
+    uint32_t width;
+    uint32_t levels;
+    uint32_t nbits;                     // raw bits of the run
+    uint64_t nsec;                      // receiver time from the preamble on
+    uint32_t payload_bits;
+    uint32_t payload_errors;            // after FEC decoding
+    uint64_t sent[BENCH_MAX_BITS / 64];
+    uint64_t received[BENCH_MAX_BITS / 64];
+};
+
+struct bench_shm *bench_shm_open(const char *name, bool create);
+void bench_shm_close(struct bench_shm *shm);
+uint32_t bench_run_bits(const struct bench_shm *shm, uint32_t symbol_bits);
+
+#endif
@@ -6,11 +6,16 @@ import shutil
 import os
 import numpy
 import json
+import re
+
+def symbolBits(paramMap):
+    # bits carried per interval, each region signals one of levels
+    return paramMap["width"] * (paramMap["levels"].bit_length() - 1)
 
 class channel_benchmark():
     def __init__(self, tests, runsPerTest=10, timeBetweenRuns=1,
                  senderCore=0, readerCore=2,
-                 channelArgs=["interval", "primeTime", "accessTime"]):
+                 channelArgs=["interval", "primeTime", "accessTime", "width", "levels", "fec"]):
 
         self.sender = ['taskset', '-c', str(senderCore),
                        sender_bin, "-b"]
@@ -111,12 +116,16 @@ class channel_benchmark():
                 print("Warning: corrupted results file")
         
         key = json.dumps([paramMap[arg] for arg in self.channelArgs])
+        # runs are [capacity, measured bits/s], older results without the
+        # measured rate are run again
+        if key in contents:
+            contents[key] = [run for run in contents[key] if isinstance(run, list)]
         if (key in contents) and (len(contents[key]) >= 3):
-            # estimate
-            bitsPerSec = 2300 * 1000 * 1000 / paramMap["interval"]
-            print("  Capacity: {}".format(max(contents[key])))
-            print("  Bandwidth: {}".format(max(contents[key]) * bitsPerSec))
-            return max(contents[key]) * bitsPerSec
+            cap, bitsPerSec = max(contents[key], key=lambda run: run[0] * run[1])
+            print("  Capacity: {}".format(cap))
+            print("  Aggregate capacity: {} bits/interval".format(cap * symbolBits(paramMap)))
+            print("  Bandwidth: {}".format(cap * bitsPerSec))
+            return cap * bitsPerSec
 
         for i in range(self.runs):
             print("  run #{}...".format(i), end='')
@@ -126,6 +135,11 @@ class channel_benchmark():
                                       + ['-i', str(paramMap['interval'])]
                                       + ['-p', str(paramMap['primeTime'])]
                                       + ['-a', str(paramMap['accessTime'])]
+                                      + ['-w', str(paramMap['width'])]
+                                      + ['-l', str(paramMap['levels'])]
+                                      # levels need minimal eviction sets
+                                      + (['-e'] if paramMap['levels'] > 2 else [])
+                                      + ['-F', paramMap['fec']]
                                       ,stdin=subprocess.PIPE
                                       ,stdout=subprocess.PIPE
                                       # ,cwd=run_dir
@@ -134,6 +148,11 @@ class channel_benchmark():
                                       + ['-i', str(paramMap['interval'])]
                                       + ['-p', str(paramMap['primeTime'])]
                                       + ['-a', str(paramMap['accessTime'])]
+                                      + ['-w', str(paramMap['width'])]
+                                      + ['-l', str(paramMap['levels'])]
+                                      # levels need minimal eviction sets
+                                      + (['-e'] if paramMap['levels'] > 2 else [])
+                                      + ['-F', paramMap['fec']]
                                       ,stdin=subprocess.PIPE
                                       ,stdout=subprocess.PIPE
                                       # ,cwd=run_dir
@@ -149,26 +168,29 @@ class channel_benchmark():
                 return 0
             print("Done")
 
-            reader_stdout = reader.communicate()[0].decode().split(' ')
-            bits = int(reader_stdout[-4])
-            nsec = int(reader_stdout[-1])
-
-            if paramMap["interval"] != 0:
-                # bitsPerSec_no_sync = 2300 * 1000 * 1000 / paramMap["interval"]
-                bitsPerSec = bits * 1e9 / nsec 
-            else:
-                eitsPerSec = 0
+            reader_output = reader.communicate()[0].decode()
+            for line in reader_output.splitlines():
+                if line.startswith("FEC"):
+                    print("  " + line)
+            # the bit rate comes from the time measured by the receiver
+            received = re.search(r"received (\d+) bits in (\d+) ns", reader_output)
+            if received is None:
+                print("Reader did not report its timing\n")
+                return 0
+            bits, nsec = int(received.group(1)), int(received.group(2))
+            bitsPerSec = bits * 1e9 / nsec
 
             if (key not in contents) :
                 contents[key] = []
             cap = float(self.capacity(self.check(senderOut, readerOut)))
             print("  Capacity: {}".format(cap))
+            print("  Aggregate capacity: {} bits/interval".format(cap * symbolBits(paramMap)))
             print("  Bandwidth: {}".format(cap * bitsPerSec))
-            contents[key] += [cap]
+            contents[key] += [[cap, bitsPerSec]]
         with open(self.resultFile, "w+") as results:
             json.dump(contents,results)
             results.flush()
-        return max(contents[key]) * bitsPerSec
+        return max(run[0] * run[1] for run in contents[key])
    
     def benchmark(self):
         for test in self.tests:
@@ -176,11 +198,15 @@ class channel_benchmark():
 
 if __name__ == '__main__':
     data = map(
-        lambda s: {"interval":s[0], "primeTime":s[1], "accessTime":s[2]},
-        [# interval, primeTime, accessTime
-         (2000000, 800000, 800000),
-         (1000000, 400000, 400000)
-         ][0:2])
+        lambda s: {"interval":s[0], "primeTime":s[1], "accessTime":s[2],
+                   "width":s[3], "levels":s[4], "fec":s[5]},
+        [# interval, primeTime, accessTime, width, levels, fec
+         (2000000, 800000, 800000, 1, 2, "none"),
+         (1000000, 400000, 400000, 1, 2, "none"),
+         (2000000, 800000, 800000, 8, 2, "none"),
+         (500000, 200000, 200000, 1, 2, "conv"),
+         (2000000, 800000, 800000, 1, 4, "none")
+         ][0:5])
 
     base_dir = os.path.dirname(os.path.abspath(__file__))
     print(base_dir)
@@ -0,0 +1,103 @@
+#include "util.h"
+
+static inline uint8_t reverse_byte(uint8_t byte)
+{
+    byte = (byte & 0xf0) >> 4 | (byte & 0x0f) << 4;
+    byte = (byte & 0xcc) >> 2 | (byte & 0x33) << 2;
+    byte = (byte & 0xaa) >> 1 | (byte & 0x55) << 1;
+    return byte;
+}
+
+void bs_init(struct bitstream *bs)
+{
+    bs->words = NULL;
+    bs->nbits = 0;
+    bs->capacity = 0;
+}
+
+void bs_free(struct bitstream *bs)
+{
+    free(bs->words);
+    bs_init(bs);
+}
+
+void bs_clear(struct bitstream *bs)
+{
+    bs->nbits = 0;
+}
+
+/*
+ * Makes room for at least nbits bits, growing the storage geometrically
+ * so that appending is amortized constant time.
+ */
+void bs_reserve(struct bitstream *bs, size_t nbits)
+{
+    if (nbits <= bs->capacity)
+        return;
+
+    size_t capacity = bs->capacity? bs->capacity: 1024;
+    while (capacity < nbits)
+        capacity *= 2;
+
+    bs->words = realloc(bs->words, capacity / 8);
+    if (bs->words == NULL) {
+        fprintf(stderr, "ERROR: failed to grow bitstream to %zu bits\n", capacity);
+        exit(-1);
+    }
+    memset(bs->words + bs->capacity / 64, 0, (capacity - bs->capacity) / 8);
+    bs->capacity = capacity;
+}
+
+void bs_push(struct bitstream *bs, bool bit)
+{
+    bs_reserve(bs, bs->nbits + 1);
+    uint64_t mask = 1ULL << (bs->nbits & 63);
+    uint64_t *word = &bs->words[bs->nbits >> 6];
+    *word = bit? *word | mask: *word & ~mask;
+    bs->nbits++;
+}
+
+/*
+ * Appends the n (<= 64) low bits of value, bit 0 first.
+ */
+void bs_push_bits(struct bitstream *bs, uint64_t value, uint32_t n)
+{
+    if (n == 0)
+        return;
+    if (n < 64)
+        value &= (1ULL << n) - 1;
+
+    bs_reserve(bs, bs->nbits + n);
+    size_t word = bs->nbits >> 6;
+    uint32_t shift = bs->nbits & 63;
+    bs->words[word] &= shift? (1ULL << shift) - 1: 0;
+    bs->words[word] |= value << shift;
+    if (shift && shift + n > 64)
+        bs->words[word + 1] = value >> (64 - shift);
+    bs->nbits += n;
+}
+
+/*
+ * Appends the given bytes, each most significant bit first.
+ */
+void bs_push_bytes(struct bitstream *bs, const uint8_t *data, size_t len)
+{
+    bs_reserve(bs, bs->nbits + len * 8);
+    for (size_t i = 0; i < len; i++) {
+        // reverse the byte so that its MSB lands first in the stream
+        bs_push_bits(bs, reverse_byte(data[i]), 8);
+    }
+}
+
+/*
+ * Packs the stream from bit pos into at most len bytes, each most
+ * significant bit first. Returns the number of whole bytes written.
+ */
+size_t bs_to_bytes(const struct bitstream *bs, size_t pos, uint8_t *data, size_t len)
+{
+    size_t count = 0;
+    for (; count < len && pos + 8 <= bs->nbits; count++, pos += 8) {
+        data[count] = reverse_byte(bs_get_bits(bs, pos, 8));
+    }
+    return count;
+}
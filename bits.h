@@ -0,0 +1,64 @@
+#ifndef BITS_H_
+#define BITS_H_
+
+// Included from util.h, which provides the standard headers.
+
+/*
+ * A packed bitstream: bit i of the stream is bit (i % 64) of words[i / 64].
+ * Bytes are appended most significant bit first, the order they go on the wire.
+ */
+struct bitstream {
+    uint64_t *words;
+    size_t nbits;
+    size_t capacity;    // in bits, always a multiple of 64
+};
+
+/*
+ * Sequential reader over a bitstream.
+ */
+struct bitreader {
+    const struct bitstream *bs;
+    size_t pos;
+};
+
+static inline bool bs_get(const struct bitstream *bs, size_t i) {
+    return (bs->words[i >> 6] >> (i & 63)) & 1;
+}
+
+/*
+ * Returns n (<= 64) bits starting at pos, stream bit pos + k being bit k of
+ * the result. Bits past the end of the stream read as zero.
+ */
+static inline uint64_t bs_get_bits(const struct bitstream *bs, size_t pos, uint32_t n) {
+    if (n == 0 || pos >= bs->nbits)
+        return 0;
+    size_t word = pos >> 6;
+    uint32_t shift = pos & 63;
+    uint64_t value = bs->words[word] >> shift;
+    if (shift && shift + n > 64 && (word + 1) * 64 < bs->capacity)
+        value |= bs->words[word + 1] << (64 - shift);
+    if (pos + n > bs->nbits)
+        n = bs->nbits - pos;
+    return n >= 64? value: value & ((1ULL << n) - 1);
+}
+
+static inline uint64_t br_read(struct bitreader *br, uint32_t n) {
+    uint64_t value = bs_get_bits(br->bs, br->pos, n);
+    br->pos += n;
+    return value;
+}
+
+static inline bool br_done(const struct bitreader *br) {
+    return br->pos >= br->bs->nbits;
+}
+
+void bs_init(struct bitstream *bs);
+void bs_free(struct bitstream *bs);
+void bs_clear(struct bitstream *bs);
+void bs_reserve(struct bitstream *bs, size_t nbits);
+void bs_push(struct bitstream *bs, bool bit);
+void bs_push_bits(struct bitstream *bs, uint64_t value, uint32_t n);
+void bs_push_bytes(struct bitstream *bs, const uint8_t *data, size_t len);
+size_t bs_to_bytes(const struct bitstream *bs, size_t pos, uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,276 @@
+#include "util.h"
+#include <cpuid.h>
+
+static void hist_add(struct latency_hist *hist, uint64_t latency)
+{
+    uint64_t bin = latency / CALIB_BIN_WIDTH;
+    hist->bins[bin < CALIB_BINS? bin: CALIB_BINS - 1]++;
+    hist->samples++;
+}
+
+/*
+ * Returns the latency below which the given fraction of samples fall.
+ */
+static uint64_t hist_percentile(const struct latency_hist *hist, double fraction)
+{
+    uint64_t count = 0;
+    for (uint32_t bin = 0; bin < CALIB_BINS; bin++) {
+        count += hist->bins[bin];
+        if (count >= fraction * hist->samples)
+            return (bin + 1) * CALIB_BIN_WIDTH;
+    }
+    return CALIB_BINS * CALIB_BIN_WIDTH;
+}
+
+/*
+ * Returns the threshold that misclassifies the fewest samples when
+ * latencies above it are taken as coming from the slow histogram.
+ */
+static uint64_t hist_split(const struct latency_hist *fast, const struct latency_hist *slow)
+{
+    // errors when splitting below bin 0: every fast sample is misclassified
+    int64_t errors = fast->samples, best_errors = errors;
+    uint32_t best_bin = 0;
+    for (uint32_t bin = 0; bin < CALIB_BINS; bin++) {
+        errors += (int64_t) slow->bins[bin] - fast->bins[bin];
+        if (errors < best_errors) {
+            best_errors = errors;
+            best_bin = bin;
+        }
+    }
+    return (best_bin + 1) * CALIB_BIN_WIDTH - 1;
+}
+
+#ifdef DEBUG
+static void hist_print(const char *name, const struct latency_hist *hist)
+{
+    printf("%s latency histogram (%u samples):\n", name, hist->samples);
+    for (uint32_t bin = 0; bin < CALIB_BINS; bin++) {
+        if (hist->bins[bin] * 1000 < hist->samples)
+            continue;
+        printf("  %4u %6u ", bin * CALIB_BIN_WIDTH, hist->bins[bin]);
+        for (uint32_t i = 0; i < hist->bins[bin] * 60 / hist->samples; i++)
+            printf("#");
+        printf("\n");
+    }
+}
+#endif
+
+/*
+ * Builds L1-hit, LLC-hit and DRAM latency histograms on a scratch buffer
+ * and picks the miss thresholds and the outlier cutoff from them.
+ */
+void calibrate_latency(struct calibration *calib)
+{
+    uint64_t bsize = (uint64_t) (CALIB_L2_EVICT_LINES + 1) * CALIB_L2_EVICT_STRIDE;
+    bsize = (bsize + geometry.hugepage_size - 1) & ~(geometry.hugepage_size - 1);
+    char *buffer = allocate_buffer(bsize);
+    ADDR_PTR target = (ADDR_PTR) buffer;
+    struct latency_hist *l1 = calloc(3, sizeof(*l1));
+    struct latency_hist *llc = l1 + 1, *dram = l1 + 2;
+
+    for (uint64_t i = 0; i < bsize; i += CACHE_LINESIZE) {
+        buffer[i] = 1;
+    }
+
+    for (uint32_t i = 0; i < CALIB_SAMPLES; i++) {
+        // L1 hit: the line was just accessed
+        load_line(target);
+        hist_add(l1, measure_one_block_access_time(target));
+
+        // LLC hit: push the line out of the private caches
+        for (uint32_t j = 1; j <= CALIB_L2_EVICT_LINES; j++) {
+            load_line(target + j * CALIB_L2_EVICT_STRIDE);
+        }
+        hist_add(llc, measure_one_block_access_time(target));
+
+        // DRAM: the line was flushed
+        clflush(target);
+        asm volatile("mfence");
+        hist_add(dram, measure_one_block_access_time(target));
+    }
+
+    calib->l1_miss_threshold = hist_split(l1, llc);
+    calib->l3_miss_threshold = hist_split(llc, dram);
+    calib->outlier_threshold = 2 * hist_percentile(dram, 0.99);
+    calib->l1_latency = hist_percentile(l1, 0.5);
+    calib->llc_latency = hist_percentile(llc, 0.5);
+    calib->dram_latency = hist_percentile(dram, 0.5);
+
+#ifdef DEBUG
+    hist_print("L1 hit", l1);
+    hist_print("LLC hit", llc);
+    hist_print("DRAM", dram);
+#endif
+    if (calib->llc_latency >= calib->dram_latency) {
+        fprintf(stderr, "ERROR: LLC hits are not faster than DRAM accesses (medians %lu LLC, "
+                "%lu DRAM), cannot calibrate the miss thresholds\n",
+                calib->llc_latency, calib->dram_latency);
+        exit(-1);
+    }
+    printf("Calibrated thresholds: L1 miss %lu, L3 miss %lu, outlier %lu cycles\n",
+           calib->l1_miss_threshold, calib->l3_miss_threshold,
+           calib->outlier_threshold);
+
+    free(l1);
+    munmap(buffer, bsize);
+}
+
+/*
+ * Builds histograms of the clflush time of a cached and of an uncached line
+ * and picks the F+F threshold between them. The difference is a few tens of
+ * cycles at most, so both are taken on the same line back to back.
+ */
+void calibrate_flush(struct calibration *calib)
+{
+    char *buffer = allocate_buffer(geometry.hugepage_size);
+    ADDR_PTR target = (ADDR_PTR) buffer;
+    struct latency_hist *uncached = calloc(2, sizeof(*uncached));
+    struct latency_hist *cached = uncached + 1;
+    buffer[0] = 1;
+
+    for (uint32_t i = 0; i < CALIB_SAMPLES; i++) {
+        load_line(target);
+        hist_add(cached, measure_flush_time(target));
+        hist_add(uncached, measure_flush_time(target));
+    }
+
+#ifdef DEBUG
+    hist_print("Flush uncached", uncached);
+    hist_print("Flush cached", cached);
+#endif
+    uint64_t uncached_median = hist_percentile(uncached, 0.5);
+    uint64_t cached_median = hist_percentile(cached, 0.5);
+    if (cached_median > uncached_median) {
+        calib->flush_threshold = hist_split(uncached, cached);
+        printf("Calibrated flush threshold: %lu cycles (medians %lu uncached, %lu cached)\n",
+               calib->flush_threshold, uncached_median, cached_median);
+    } else {
+        fprintf(stderr, "WARNING: clflush is not slower on cached lines (medians %lu uncached, "
+                "%lu cached), keeping the flush threshold of %lu cycles\n",
+                uncached_median, cached_median, calib->flush_threshold);
+    }
+
+    free(uncached);
+    munmap(buffer, geometry.hugepage_size);
+}
+
+/*
+ * Checks cheaply that a calibration made earlier still describes the host:
+ * the medians of a few L1 hits and DRAM accesses must stay nearer to its
+ * L1 and DRAM latencies than to its LLC latency.
+ */
+bool calibrate_check(const struct calibration *calib)
+{
+    char *line = aligned_alloc(CACHE_LINESIZE, CACHE_LINESIZE);
+    ADDR_PTR target = (ADDR_PTR) line;
+    struct latency_hist *hit = calloc(2, sizeof(*hit));
+    struct latency_hist *dram = hit + 1;
+    line[0] = 1;
+
+    for (uint32_t i = 0; i < CALIB_CHECK_SAMPLES; i++) {
+        load_line(target);
+        hist_add(hit, measure_one_block_access_time(target));
+        clflush(target);
+        asm volatile("mfence");
+        hist_add(dram, measure_one_block_access_time(target));
+    }
+    uint64_t hit_median = hist_percentile(hit, 0.5);
+    uint64_t dram_median = hist_percentile(dram, 0.5);
+    debug("Calibration check: medians %lu hit, %lu DRAM\n", hit_median, dram_median);
+
+    free(hit);
+    free(line);
+    int64_t l1_latency = calib->l1_latency, llc_latency = calib->llc_latency;
+    int64_t dram_latency = calib->dram_latency;
+    return llabs((int64_t) hit_median - l1_latency) < llabs((int64_t) hit_median - llc_latency) &&
+           llabs((int64_t) dram_median - dram_latency) < llabs((int64_t) dram_median - llc_latency);
+}
+
+static uint64_t elapsed_nsec(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000000ULL + to->tv_nsec - from->tv_nsec;
+}
+
+/*
+ * Measures the TSC against CLOCK_MONOTONIC_RAW over nsec, the TSC reads
+ * bracketing each clock read to bound the error.
+ */
+static double tsc_hz_measured(uint64_t nsec)
+{
+    struct timespec beg, end;
+    uint64_t tsc_beg = rdtsc();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &beg);
+    tsc_beg = (tsc_beg + rdtsc()) / 2;
+    do {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    } while (elapsed_nsec(&beg, &end) < nsec);
+    uint64_t tsc_end = rdtsc();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    tsc_end = (tsc_end + rdtsc()) / 2;
+    return (tsc_end - tsc_beg) * 1e9 / elapsed_nsec(&beg, &end);
+}
+
+/*
+ * Returns the TSC frequency CPUID reports: from leaf 0x15 (TSC to crystal
+ * ratio) when it reports the crystal, otherwise the base frequency of leaf
+ * 0x16. Returns 0 if neither is available.
+ */
+static double tsc_hz_cpuid(const char **source)
+{
+    unsigned int max_leaf = __get_cpuid_max(0, NULL), eax, ebx, ecx, edx;
+    if (max_leaf >= 0x15 && __get_cpuid(0x15, &eax, &ebx, &ecx, &edx) && eax && ebx && ecx) {
+        *source = "CPUID 0x15";
+        return (double) ecx * ebx / eax;
+    }
+    if (max_leaf >= 0x16 && __get_cpuid(0x16, &eax, &ebx, &ecx, &edx) && eax) {
+        *source = "CPUID 0x16";
+        return eax * 1e6;
+    }
+    return 0;
+}
+
+static double tsc_freq = 0;
+
+/*
+ * Returns the TSC frequency in Hz, detected on first use from CPUID, and
+ * otherwise measured against the monotonic clock.
+ */
+double tsc_hz()
+{
+#ifdef SIMULATOR
+    return SIM_TSC_HZ;      // the TSC is virtual
+#endif
+    if (tsc_freq > 0)
+        return tsc_freq;
+
+    const char *source;
+    tsc_freq = tsc_hz_cpuid(&source);
+    if (tsc_freq == 0) {
+        tsc_freq = tsc_hz_measured(CALIB_TSC_NSEC);
+        source = "CLOCK_MONOTONIC_RAW";
+    }
+    debug("TSC frequency %.1f MHz (%s)\n", tsc_freq / 1e6, source);
+    return tsc_freq;
+}
+
+/*
+ * Adopts a TSC frequency measured earlier if it agrees within
+ * CALIB_CHECK_TSC_ERROR with the one in use, with CPUID, or else with a
+ * short measurement. Returns whether it agreed.
+ */
+bool tsc_hz_check(double hz)
+{
+    const char *source;
+    double reference = tsc_freq > 0? tsc_freq: tsc_hz_cpuid(&source);
+    if (reference == 0) {
+        reference = tsc_hz_measured(CALIB_CHECK_TSC_NSEC);
+    }
+    if (fabs(reference - hz) > CALIB_CHECK_TSC_ERROR * hz)
+        return false;
+    if (tsc_freq == 0) {
+        tsc_freq = hz;
+        debug("TSC frequency %.1f MHz (profile)\n", tsc_freq / 1e6);
+    }
+    return true;
+}
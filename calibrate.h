@@ -0,0 +1,46 @@
+#ifndef CALIBRATE_H_
+#define CALIBRATE_H_
+
+// Included from util.h, which provides the standard headers.
+
+#define CALIB_SAMPLES           10000
+#define CALIB_BIN_WIDTH         4       // cycles per histogram bin
+#define CALIB_BINS              512     // latencies up to 2048 cycles
+// Lines walked to push a line out of L1 and L2 but not the LLC; they share
+// the L2 set index of the target for any L2 of up to 2048 sets, and its LLC
+// slice set too, so just enough of them to overflow L1 and L2 are walked
+#define CALIB_L2_EVICT_STRIDE   (1 << 17)
+#define CALIB_L2_EVICT_SLACK    2
+#define CALIB_L2_EVICT_LINES    (geometry.l1_ways + geometry.l2_ways + CALIB_L2_EVICT_SLACK)
+
+struct latency_hist {
+    uint32_t bins[CALIB_BINS];
+    uint32_t samples;
+};
+
+/*
+ * Latency thresholds picked from the histograms, all in cycles.
+ */
+struct calibration {
+    uint64_t l1_miss_threshold;     // L1 hit vs LLC hit
+    uint64_t l3_miss_threshold;     // LLC hit vs DRAM
+    uint64_t outlier_threshold;     // longer samples are not cache effects
+    uint64_t flush_threshold;       // clflush of an uncached vs a cached line
+    uint64_t l1_latency;            // medians, their differences are miss penalties
+    uint64_t llc_latency;
+    uint64_t dram_latency;
+};
+
+#define CALIB_TSC_NSEC          20000000    // cross-calibration against CLOCK_MONOTONIC_RAW
+// Checks of a calibration reused from a profile
+#define CALIB_CHECK_SAMPLES     256
+#define CALIB_CHECK_TSC_NSEC    1000000
+#define CALIB_CHECK_TSC_ERROR   0.01        // relative
+
+void calibrate_latency(struct calibration *calib);
+void calibrate_flush(struct calibration *calib);
+bool calibrate_check(const struct calibration *calib);
+double tsc_hz();
+bool tsc_hz_check(double hz);
+
+#endif
@@ -0,0 +1,769 @@
+#define _GNU_SOURCE     // sched_setaffinity
+#include "util.h"
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/*
+ * Sweeps interval x prime x access grids over sender and receiver workers
+ * pinned to their cores. The workers run in benchmark mode and share their
+ * bits through shared memory, from which the transition matrix between the
+ * levels sent and received, and the capacity of the channel, are computed.
+ *
+ * With -T, searches for the timing of the highest bandwidth (capacity times
+ * symbol rate) instead: a coarse grid over the -I range with the prime and
+ * access periods as fractions of the interval, then a golden-section search
+ * on each parameter around the best point. Points are screened on a short
+ * run first and dropped when clearly worse than the best so far. The result
+ * is written to a profile that the sender and receiver load with -P.
+ *
+ * With -N, the sweep is repeated under each noise profile, with antagonists
+ * (see stress.h) running on the -C cores, and the best bandwidth under each
+ * one is summed up at the end.
+ *
+ * Usage: ccbench [-I intervals] [-P primes] [-A accesses] [-c channels] [-n runs]
+ *                [-s sender core] [-r receiver core] [-v] [-T profile]
+ *                [-N noise profiles] [-C antagonist cores] [-- worker options]
+ */
+
+#define CCBENCH_MAX_VALUES      32
+#define CCBENCH_STARTUP_SEC     60      // allowance for buffer setup and calibration
+#define CCBENCH_BA_ITERATIONS   10000
+#define CCBENCH_BA_EPSILON      1e-9
+#define CCBENCH_TUNE_GRID       5       // intervals of the coarse grid
+#define CCBENCH_TUNE_STEPS      6       // golden-section steps per parameter
+#define CCBENCH_MIN_FRACTION    0.05    // of the interval, for prime and access
+#define CCBENCH_SCREEN_BITS     512     // bits of the early-abort run
+#define CCBENCH_SCREEN_RATIO    0.5     // of the best bandwidth to pass screening
+#define CCBENCH_GOLDEN          0.6180339887498949
+
+static char sender_bin[PATH_MAX], receiver_bin[PATH_MAX];
+static bool verbose = false;
+static uint32_t runs = 1;
+static int sender_core = 0, receiver_core = 2;
+static int worker_argc;
+static char **worker_argv;
+
+struct result {
+    double ber;
+    double capacity;            // bits per region and interval
+    double bandwidth;           // bits/s over all regions
+    double post_fec_ber;
+};
+
+// the best configuration of a sweep
+struct best {
+    struct result result;
+    int channel;
+    uint64_t interval, prime, access;
+};
+
+// the grid of the sweep
+static uint64_t intervals[CCBENCH_MAX_VALUES] = { 2000000, 1000000 };
+static uint64_t primes[CCBENCH_MAX_VALUES] = { 800000, 400000 };
+static uint64_t accesses[CCBENCH_MAX_VALUES] = { 800000, 400000 };
+static int channels[CCBENCH_MAX_VALUES];      // -1 leaves it to the worker options
+static uint32_t n_intervals = 2, n_primes = 2, n_accesses = 2, n_channels = 0;
+
+/*
+ * Parses a comma separated list of durations (cycles, or with an ns, us or ms
+ * suffix), returns how many there are.
+ */
+static uint32_t parse_list(char *arg, uint64_t *values)
+{
+    uint32_t n = 0;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == CCBENCH_MAX_VALUES) {
+            fprintf(stderr, "ERROR: at most %d values per sweep!\n", CCBENCH_MAX_VALUES);
+            exit(-1);
+        }
+        values[n++] = parse_duration(tok);
+    }
+    return n;
+}
+
+/*
+ * Parses a comma separated list of channels (0 to 3, as for -c of the
+ * workers), returns how many there are.
+ */
+static uint32_t parse_channels(char *arg, int *values)
+{
+    uint32_t n = 0;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == CCBENCH_MAX_VALUES) {
+            fprintf(stderr, "ERROR: at most %d values per sweep!\n", CCBENCH_MAX_VALUES);
+            exit(-1);
+        }
+        char *end;
+        errno = 0;
+        unsigned long channel = strtoul(tok, &end, 10);
+        if (end == tok || *end != '\0' || errno || channel > FlushFlush) {
+            fprintf(stderr, "ERROR: invalid channel %s (0 to %d)!\n", tok, FlushFlush);
+            exit(-1);
+        }
+        values[n++] = channel;
+    }
+    return n;
+}
+
+/*
+ * Finds the sender and receiver binaries next to this one.
+ */
+static void locate_workers()
+{
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+        fprintf(stderr, "ERROR: cannot locate the ccbench binary\n");
+        exit(-1);
+    }
+    self[len] = '\0';
+    char *slash = strrchr(self, '/');
+    *slash = '\0';
+    if (snprintf(sender_bin, sizeof(sender_bin), "%s/sender", self) >= (int) sizeof(sender_bin) ||
+        snprintf(receiver_bin, sizeof(receiver_bin), "%s/receiver", self) >= (int) sizeof(receiver_bin)) {
+        fprintf(stderr, "ERROR: the directory of the ccbench binary is too long\n");
+        exit(-1);
+    }
+}
+
+static pid_t spawn_worker(const char *bin, int core, char **args)
+{
+    pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "ERROR: fork failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    if (pid > 0)
+        return pid;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        fprintf(stderr, "ERROR: cannot pin %s to core %d: %s\n", bin, core, strerror(errno));
+        _exit(-1);
+    }
+    if (!verbose) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    args[0] = (char *) bin;
+    execv(bin, args);
+    fprintf(stderr, "ERROR: cannot run %s: %s\n", bin, strerror(errno));
+    _exit(-1);
+}
+
+/*
+ * Waits for both workers to exit, killing them after timeout seconds.
+ * Returns false if they had to be killed or failed. Only the workers are
+ * waited for, the antagonists are children of ccbench as well.
+ */
+static bool wait_workers(pid_t sender, pid_t receiver, double timeout)
+{
+    struct timespec start, now, nap = { 0, 10 * 1000 * 1000 };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = true;
+    pid_t workers[2] = { sender, receiver };
+    int running = 2;
+
+    while (running > 0) {
+        for (int i = 0; i < 2; i++) {
+            int status;
+            if (workers[i] > 0 && waitpid(workers[i], &status, WNOHANG) == workers[i]) {
+                ok &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                workers[i] = 0;
+                running--;
+            }
+        }
+        if (running == 0)
+            break;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - start.tv_sec + (now.tv_nsec - start.tv_nsec) / 1e9 > timeout) {
+            for (int i = 0; i < 2; i++) {
+                if (workers[i] > 0) {
+                    kill(workers[i], SIGKILL);
+                    waitpid(workers[i], NULL, 0);
+                }
+            }
+            return false;
+        }
+        nanosleep(&nap, NULL);
+    }
+    return ok;
+}
+
+/*
+ * Returns the capacity in bits per use of the channel with the given m x m
+ * transition counts, by the Blahut-Arimoto algorithm.
+ */
+static double capacity(const uint64_t *counts, uint32_t m)
+{
+    double p[MAX_CHANNEL_LEVELS][MAX_CHANNEL_LEVELS];
+    double r[MAX_CHANNEL_LEVELS], q[MAX_CHANNEL_LEVELS];
+
+    for (uint32_t i = 0; i < m; i++) {
+        uint64_t row = 0;
+        for (uint32_t j = 0; j < m; j++) {
+            row += counts[i * m + j];
+        }
+        if (row == 0)
+            return 0;
+        for (uint32_t j = 0; j < m; j++) {
+            p[i][j] = (double) counts[i * m + j] / row;
+        }
+        r[i] = 1.0 / m;
+    }
+
+    double cap = 0;
+    for (int iter = 0; iter < CCBENCH_BA_ITERATIONS; iter++) {
+        // output distribution, then the information of each input
+        for (uint32_t j = 0; j < m; j++) {
+            q[j] = 0;
+            for (uint32_t i = 0; i < m; i++) {
+                q[j] += r[i] * p[i][j];
+            }
+        }
+        double c[MAX_CHANNEL_LEVELS], total = 0;
+        for (uint32_t i = 0; i < m; i++) {
+            double d = 0;
+            for (uint32_t j = 0; j < m; j++) {
+                if (p[i][j] > 0)
+                    d += p[i][j] * log2(p[i][j] / q[j]);
+            }
+            c[i] = r[i] * exp2(d);
+            total += c[i];
+        }
+
+        double lower = log2(total);
+        double upper = -HUGE_VAL;
+        for (uint32_t i = 0; i < m; i++) {
+            double d = log2(c[i] / r[i]);
+            upper = d > upper? d: upper;
+            r[i] = c[i] / total;
+        }
+        cap = lower;
+        if (upper - lower < CCBENCH_BA_EPSILON)
+            break;
+    }
+    return cap;
+}
+
+/*
+ * Runs one benchmark over the workers and fills result from the bits they
+ * shared. Returns false if the run failed.
+ */
+static bool run_once(int channel, uint64_t interval, uint64_t prime, uint64_t access,
+                     uint32_t max_bits, struct result *result)
+{
+    char name[64], channel_s[32], interval_s[32], prime_s[32], access_s[32];
+    snprintf(name, sizeof(name), "/ccbench-%d", getpid());
+    snprintf(channel_s, sizeof(channel_s), "%d", channel);
+    snprintf(interval_s, sizeof(interval_s), "%lu", interval);
+    snprintf(prime_s, sizeof(prime_s), "%lu", prime);
+    snprintf(access_s, sizeof(access_s), "%lu", access);
+
+    char *args[worker_argc + 12];
+    int n = 1;
+    args[n++] = "-B";
+    args[n++] = name;
+    if (channel >= 0) {
+        args[n++] = "-c";
+        args[n++] = channel_s;
+    }
+    args[n++] = "-i";
+    args[n++] = interval_s;
+    args[n++] = "-p";
+    args[n++] = prime_s;
+    args[n++] = "-a";
+    args[n++] = access_s;
+    for (int i = 0; i < worker_argc; i++) {
+        args[n++] = worker_argv[i];
+    }
+    args[n] = NULL;
+
+    struct bench_shm *shm = bench_shm_open(name, true);
+    shm->max_bits = max_bits;
+    pid_t receiver = spawn_worker(receiver_bin, receiver_core, args);
+    pid_t sender = spawn_worker(sender_bin, sender_core, args);
+
+    // twice the slots for Manchester coding, plus the preamble
+    double timeout = CCBENCH_STARTUP_SEC + (2.0 * max_bits + 1024) * interval / tsc_hz();
+    bool ok = wait_workers(sender, receiver, timeout) && shm->receiver_done;
+    shm_unlink(name);
+    if (!ok) {
+        bench_shm_close(shm);
+        return false;
+    }
+
+    // count level transitions of every region of every symbol
+    uint32_t m = shm->levels;
+    uint32_t level_bits = __builtin_ctz(m);
+    uint32_t symbol_bits = shm->width * level_bits;
+    uint64_t counts[MAX_CHANNEL_LEVELS * MAX_CHANNEL_LEVELS] = {0};
+    struct bitstream sent = { shm->sent, shm->nbits, BENCH_MAX_BITS };
+    struct bitstream received = { shm->received, shm->nbits, BENCH_MAX_BITS };
+    uint32_t errors = 0;
+    for (uint32_t pos = 0; pos + symbol_bits <= shm->nbits; pos += symbol_bits) {
+        for (uint32_t k = 0; k < shm->width; k++) {
+            uint32_t from = bits_to_level(bs_get_bits(&sent, pos + k * level_bits, level_bits));
+            uint32_t to = bits_to_level(bs_get_bits(&received, pos + k * level_bits, level_bits));
+            counts[from * m + to]++;
+        }
+    }
+    for (uint32_t i = 0; i < shm->nbits; i++) {
+        errors += bs_get(&sent, i) != bs_get(&received, i);
+    }
+
+    if (verbose) {
+        printf("    transitions (sent level per row):\n");
+        for (uint32_t i = 0; i < m; i++) {
+            printf("   ");
+            for (uint32_t j = 0; j < m; j++) {
+                printf(" %6lu", counts[i * m + j]);
+            }
+            printf("\n");
+        }
+    }
+
+    double symbols_per_sec = (double) (shm->nbits / symbol_bits) * 1e9 / shm->nsec;
+    result->ber = (double) errors / shm->nbits;
+    result->capacity = capacity(counts, m);
+    result->bandwidth = result->capacity * shm->width * symbols_per_sec;
+    result->post_fec_ber = shm->payload_bits? (double) shm->payload_errors / shm->payload_bits: 0;
+    bench_shm_close(shm);
+    return true;
+}
+
+/*
+ * Runs a configuration the given number of times over max_bits bits and
+ * keeps the best run in top. Returns false if every run failed. A negative
+ * channel leaves it to the worker options.
+ */
+static bool measure(int channel, uint64_t interval, uint64_t prime, uint64_t access,
+                    uint32_t max_bits, struct result *top)
+{
+    struct result result;
+    uint32_t done = 0;
+    for (uint32_t r = 0; r < runs; r++) {
+        if (!run_once(channel, interval, prime, access, max_bits, &result))
+            continue;
+        if (done++ == 0 || result.bandwidth > top->bandwidth)
+            *top = result;
+    }
+    return done > 0;
+}
+
+static void print_header()
+{
+    printf("%10s %10s %10s %10s %12s %14s %12s\n", "interval", "prime", "access",
+           "raw BER", "capacity", "bandwidth", "post-FEC BER");
+}
+
+static void print_row(uint64_t interval, uint64_t prime, uint64_t access,
+                      const struct result *result, const char *note)
+{
+    printf("%10lu %10lu %10lu %10.6f %12.4f %14.1f %12.6f%s\n",
+           interval, prime, access, result->ber, result->capacity,
+           result->bandwidth, result->post_fec_ber, note);
+    fflush(stdout);
+}
+
+/*
+ * The search space of -T: the interval, and the prime and access periods
+ * as fractions of it.
+ */
+struct tuner {
+    double interval, prime, access;
+    struct profile best;
+};
+
+/*
+ * Measures the point of the tuner, screening it on a short run first.
+ * Returns its bandwidth (0 if it failed) and keeps it if it is the best.
+ */
+static double tune_point(struct tuner *tuner)
+{
+    uint64_t interval = tuner->interval;
+    uint64_t prime = tuner->prime * interval, access = tuner->access * interval;
+    struct result result;
+    if (!measure(-1, interval, prime, access, CCBENCH_SCREEN_BITS, &result)) {
+        printf("%10lu %10lu %10lu %10s\n", interval, prime, access, "failed");
+        return 0;
+    }
+    if (result.bandwidth < CCBENCH_SCREEN_RATIO * tuner->best.bandwidth) {
+        print_row(interval, prime, access, &result, " (screened out)");
+        return result.bandwidth;
+    }
+    if (!measure(-1, interval, prime, access, BENCH_MAX_BITS, &result)) {
+        printf("%10lu %10lu %10lu %10s\n", interval, prime, access, "failed");
+        return 0;
+    }
+    print_row(interval, prime, access, &result, "");
+
+    if (result.bandwidth > tuner->best.bandwidth) {
+        tuner->best = (struct profile) {
+            .interval = interval,
+            .prime_period = prime,
+            .access_period = access,
+            .bandwidth = result.bandwidth,
+            .capacity = result.capacity,
+        };
+    }
+    return result.bandwidth;
+}
+
+/*
+ * Golden-section search of *x within [lo, hi] for the highest bandwidth,
+ * leaving *x at the best point found. On a log scale for the interval.
+ */
+static void golden_search(struct tuner *tuner, double *x, double lo, double hi, bool log_scale)
+{
+    if (log_scale) {
+        lo = log(lo);
+        hi = log(hi);
+    }
+    double a = hi - CCBENCH_GOLDEN * (hi - lo), b = lo + CCBENCH_GOLDEN * (hi - lo);
+    *x = log_scale? exp(a): a;
+    double fa = tune_point(tuner);
+    *x = log_scale? exp(b): b;
+    double fb = tune_point(tuner);
+
+    for (int step = 0; step < CCBENCH_TUNE_STEPS; step++) {
+        if (fa >= fb) {
+            hi = b;
+            b = a;
+            fb = fa;
+            a = hi - CCBENCH_GOLDEN * (hi - lo);
+            *x = log_scale? exp(a): a;
+            fa = tune_point(tuner);
+        } else {
+            lo = a;
+            a = b;
+            fa = fb;
+            b = lo + CCBENCH_GOLDEN * (hi - lo);
+            *x = log_scale? exp(b): b;
+            fb = tune_point(tuner);
+        }
+    }
+}
+
+/*
+ * Tunes the timing between the smallest and largest of the intervals,
+ * writes the best one found to the profile at path.
+ */
+static void autotune(const uint64_t *intervals, uint32_t n_intervals, const char *path)
+{
+    uint64_t lo = intervals[0], hi = intervals[0];
+    for (uint32_t i = 1; i < n_intervals; i++) {
+        lo = intervals[i] < lo? intervals[i]: lo;
+        hi = intervals[i] > hi? intervals[i]: hi;
+    }
+    if (lo == hi) {
+        lo = hi / 4;
+    }
+
+    // coarse grid, geometric in the interval
+    static const double fractions[] = { 0.2, 0.4 };
+    struct tuner tuner = { 0 };
+    double ratio = pow((double) hi / lo, 1.0 / (CCBENCH_TUNE_GRID - 1));
+    double best_interval = 0, best_prime = 0, best_access = 0;
+    print_header();
+    for (int i = 0; i < CCBENCH_TUNE_GRID; i++) {
+        for (int p = 0; p < 2; p++) {
+            for (int a = 0; a < 2; a++) {
+                tuner.interval = lo * pow(ratio, i);
+                tuner.prime = fractions[p];
+                tuner.access = fractions[a];
+                double before = tuner.best.bandwidth;
+                tune_point(&tuner);
+                if (tuner.best.bandwidth > before) {
+                    best_interval = tuner.interval;
+                    best_prime = tuner.prime;
+                    best_access = tuner.access;
+                }
+            }
+        }
+    }
+    if (tuner.best.bandwidth == 0) {
+        fprintf(stderr, "ERROR: no configuration carried any information\n");
+        exit(-1);
+    }
+
+    // refine each parameter around the best point, within its grid neighbours
+    tuner.prime = best_prime;
+    tuner.access = best_access;
+    golden_search(&tuner, &tuner.interval, best_interval / ratio, best_interval * ratio, true);
+    tuner.interval = tuner.best.interval;
+    golden_search(&tuner, &tuner.prime, CCBENCH_MIN_FRACTION,
+                  1 - best_access - CCBENCH_MIN_FRACTION, false);
+    tuner.prime = (double) tuner.best.prime_period / tuner.best.interval;
+    golden_search(&tuner, &tuner.access, CCBENCH_MIN_FRACTION,
+                  1 - tuner.prime - CCBENCH_MIN_FRACTION, false);
+
+    tuner.best.dirty = PROFILE_TIMING;
+    profile_save(path, &tuner.best);
+    printf("Best: -i %lu -p %lu -a %lu at %.1f bits/s (capacity %.4f bits/use), saved to %s\n",
+           tuner.best.interval, tuner.best.prime_period, tuner.best.access_period,
+           tuner.best.bandwidth, tuner.best.capacity, path);
+}
+
+/*
+ * Sweeps every channel over the grid, printing a row per configuration.
+ * Returns whether any configuration carried information, the best one in
+ * best.
+ */
+static bool sweep(struct best *best)
+{
+    memset(best, 0, sizeof(*best));
+    best->channel = -1;
+    for (uint32_t c = 0; c < n_channels; c++) {
+        int channel = channels[c];
+        if (channel >= 0) {
+            printf("Channel %d:\n", channel);
+        }
+        print_header();
+        for (uint32_t i = 0; i < n_intervals; i++) {
+            for (uint32_t p = 0; p < n_primes; p++) {
+                for (uint32_t a = 0; a < n_accesses; a++) {
+                    if (primes[p] + accesses[a] > intervals[i])
+                        continue;
+
+                    struct result top;
+                    if (!measure(channel, intervals[i], primes[p], accesses[a],
+                                 BENCH_MAX_BITS, &top)) {
+                        printf("%10lu %10lu %10lu %10s\n", intervals[i], primes[p], accesses[a], "failed");
+                        continue;
+                    }
+                    print_row(intervals[i], primes[p], accesses[a], &top, "");
+                    if (top.bandwidth > best->result.bandwidth) {
+                        *best = (struct best) {
+                            .result = top,
+                            .channel = channel,
+                            .interval = intervals[i],
+                            .prime = primes[p],
+                            .access = accesses[a],
+                        };
+                    }
+                }
+            }
+        }
+    }
+    return best->result.bandwidth > 0;
+}
+
+static void print_best(const struct best *best)
+{
+    if (best->channel >= 0) {
+        printf("Best: -c %d -i %lu -p %lu -a %lu at %.1f bits/s (capacity %.4f bits/use)\n",
+               best->channel, best->interval, best->prime, best->access,
+               best->result.bandwidth, best->result.capacity);
+    } else {
+        printf("Best: -i %lu -p %lu -a %lu at %.1f bits/s (capacity %.4f bits/use)\n",
+               best->interval, best->prime, best->access, best->result.bandwidth,
+               best->result.capacity);
+    }
+}
+
+static void format_profile(const struct stress_profile *profile, char *label, size_t len)
+{
+    if (profile->kind == StressIdle) {
+        snprintf(label, len, "idle");
+    } else if (profile->kind == StressSameSet) {
+        snprintf(label, len, "sameset %.0f%% set %lu", profile->intensity * 100, profile->set);
+    } else {
+        snprintf(label, len, "%s %.0f%%", stress_name(profile->kind), profile->intensity * 100);
+    }
+}
+
+/*
+ * Sums up the best bandwidth under each noise profile, relative to the
+ * first idle one if any.
+ */
+static void print_summary(const struct stress_profile *profiles, const struct best *bests,
+                          const bool *found, uint32_t n_profiles)
+{
+    double idle = 0;
+    for (uint32_t p = 0; p < n_profiles && idle == 0; p++) {
+        if (profiles[p].kind == StressIdle && found[p])
+            idle = bests[p].result.bandwidth;
+    }
+
+    printf("\nCapacity under load:\n");
+    printf("%-22s %10s %12s %14s %10s  %s\n", "noise", "raw BER", "capacity", "bandwidth",
+           "of idle", "best timing");
+    for (uint32_t p = 0; p < n_profiles; p++) {
+        char label[64];
+        format_profile(&profiles[p], label, sizeof(label));
+        if (!found[p]) {
+            printf("%-22s %10s\n", label, "failed");
+            continue;
+        }
+        const struct best *best = &bests[p];
+        char share[16] = "-";
+        if (idle > 0) {
+            snprintf(share, sizeof(share), "%.1f%%", 100 * best->result.bandwidth / idle);
+        }
+        printf("%-22s %10.6f %12.4f %14.1f %10s  -i %lu -p %lu -a %lu\n", label,
+               best->result.ber, best->result.capacity, best->result.bandwidth, share,
+               best->interval, best->prime, best->access);
+    }
+}
+
+/*
+ * Parses a comma separated list of cores, returns how many there are.
+ */
+static uint32_t parse_cores(char *arg, int *cores)
+{
+    uint32_t n = 0;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == STRESS_MAX_CORES) {
+            fprintf(stderr, "ERROR: at most %d antagonist cores!\n", STRESS_MAX_CORES);
+            exit(-1);
+        }
+        cores[n++] = atoi(tok);
+    }
+    return n;
+}
+
+/*
+ * Parses a comma separated list of noise profiles, returns how many there
+ * are.
+ */
+static uint32_t parse_profiles(char *arg, struct stress_profile *profiles)
+{
+    uint32_t n = 0;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == STRESS_MAX_PROFILES) {
+            fprintf(stderr, "ERROR: at most %d noise profiles!\n", STRESS_MAX_PROFILES);
+            exit(-1);
+        }
+        stress_parse(tok, &profiles[n++]);
+    }
+    return n;
+}
+
+static void print_usage()
+{
+    printf("Usage: ccbench [options] [-- sender/receiver options]\n");
+    printf("-I: (time[,time...]) intervals to sweep, in cycles or with ns, us or ms\n");
+    printf("-P: (time[,time...]) prime periods to sweep\n");
+    printf("-A: (time[,time...]) access periods to sweep\n");
+    printf("-n: (uint) runs per configuration, the best one counts\n");
+    printf("-s: (uint) core to pin the sender to\n");
+    printf("-r: (uint) core to pin the receiver to\n");
+    printf("-c: (uint[,uint...]) channels to sweep side by side (e.g. 1,3 for F+R and F+F)\n");
+    printf("-v: to show the worker output and transition matrices\n");
+    printf("-T: (path) to search the best timing within the -I range into a profile\n");
+    printf("-N: (profile[,profile...]) noise to sweep under, each kind[:intensity[:set]] of\n"
+           "    idle, stream, thrash, sameset or syscall with an intensity within (0, 1]\n");
+    printf("-C: (uint[,uint...]) cores to run one antagonist on each\n");
+    printf("-h: to print this message\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct stress_profile profiles[STRESS_MAX_PROFILES] = { { .kind = StressIdle } };
+    uint32_t n_profiles = 1;
+    int stress_cores[STRESS_MAX_CORES] = { 1 };
+    uint32_t n_stress_cores = 1;
+    char *tune_path = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "I:P:A:c:n:s:r:vT:N:C:h")) != -1) {
+        switch (option) {
+            case 'I':
+                n_intervals = parse_list(optarg, intervals);
+                break;
+            case 'P':
+                n_primes = parse_list(optarg, primes);
+                break;
+            case 'A':
+                n_accesses = parse_list(optarg, accesses);
+                break;
+            case 'c':
+                n_channels = parse_channels(optarg, channels);
+                break;
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            case 's':
+                sender_core = atoi(optarg);
+                break;
+            case 'r':
+                receiver_core = atoi(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            case 'T':
+                tune_path = optarg;
+                break;
+            case 'N':
+                n_profiles = parse_profiles(optarg, profiles);
+                break;
+            case 'C':
+                n_stress_cores = parse_cores(optarg, stress_cores);
+                break;
+            case 'h':
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+    worker_argc = argc - optind;
+    worker_argv = argv + optind;
+    locate_workers();
+    for (uint32_t i = 0; i < n_stress_cores; i++) {
+        if (stress_cores[i] == sender_core || stress_cores[i] == receiver_core) {
+            fprintf(stderr, "WARNING: antagonists share core %d with a worker\n", stress_cores[i]);
+        }
+    }
+
+    struct stress stress;
+    if (tune_path) {
+        if (n_profiles > 1) {
+            fprintf(stderr, "ERROR: -T tunes under a single noise profile\n");
+            exit(-1);
+        }
+        stress_start(&stress, &profiles[0], stress_cores, n_stress_cores);
+        autotune(intervals, n_intervals, tune_path);
+        stress_stop(&stress);
+        return 0;
+    }
+
+    // without -c the channel comes from the worker options
+    if (n_channels == 0) {
+        channels[n_channels++] = -1;
+    }
+
+    struct best bests[STRESS_MAX_PROFILES];
+    bool found[STRESS_MAX_PROFILES];
+    for (uint32_t p = 0; p < n_profiles; p++) {
+        if (n_profiles > 1 || profiles[p].kind != StressIdle) {
+            char label[64];
+            format_profile(&profiles[p], label, sizeof(label));
+            printf("%sNoise: %s", p? "\n": "", label);
+            if (profiles[p].kind != StressIdle) {
+                printf(" on cores");
+                for (uint32_t i = 0; i < n_stress_cores; i++) {
+                    printf("%s%d", i? ",": " ", stress_cores[i]);
+                }
+            }
+            printf("\n");
+        }
+        stress_start(&stress, &profiles[p], stress_cores, n_stress_cores);
+        found[p] = sweep(&bests[p]);
+        stress_stop(&stress);
+        if (found[p]) {
+            print_best(&bests[p]);
+        }
+    }
+    if (n_profiles > 1) {
+        print_summary(profiles, bests, found, n_profiles);
+    }
+    return 0;
+}
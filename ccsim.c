@@ -0,0 +1,408 @@
+#include "util.h"
+#include <fcntl.h>
+
+/*
+ * Runs the channel between a sender and a receiver thread on the software
+ * cache model of sim.h instead of the hardware, in lockstep virtual time:
+ * any box runs the same experiment bit for bit, thousands per minute for
+ * short messages. Every run sends the preamble (and training sequence)
+ * followed by random bits, reporting raw BER, post-FEC BER and goodput in
+ * virtual time, or with -f random frames, reporting how many pass the CRC.
+ *
+ * Usage: ccsim [-n runs] [-S seed] [-b bits | -f frames] [-R policy]
+ *              [-g sets,ways,slices] [-N rate] [-J cycles] [-X rate]
+ *              [-q quantum] [-v] [-- channel options]
+ */
+
+#define CCSIM_DEFAULT_BITS      4096
+#define CCSIM_MARGIN_SLOTS      64      // past the last slot, before giving up on a run
+
+enum outcome {
+    FrameOk = 0,
+    FrameCorrupt,                       // dropped on its CRC
+    FrameLost,                          // no resync word
+    FrameUndetected,                    // passed the CRC with wrong contents
+    FRAME_OUTCOMES
+};
+
+/*
+ * One experiment, shared by the sender and receiver threads of a run. Both
+ * sides derive what was sent from the seed.
+ */
+struct experiment {
+    const struct config *sender;
+    struct config *receiver;
+    uint64_t seed;
+    uint32_t frames;                    // frame mode when non-zero
+
+    struct bitstream payload, raw;      // raw mode
+    uint32_t payload_bits;
+    struct bitstream received, decoded;
+    uint8_t *soft;
+
+    struct frame *sent;                 // frame mode
+    uint32_t outcomes[FRAME_OUTCOMES];
+
+    uint64_t start_t, end_t;            // receiver time from the preamble on
+};
+
+static const char *outcome_names[FRAME_OUTCOMES] = { "ok", "corrupt", "lost", "undetected" };
+static const char *channel_names[] = { "LLC prime+probe", "flush+reload", "L1D prime+probe", "flush+flush" };
+
+static void random_frames(struct experiment *exp)
+{
+    uint64_t state = exp->seed;
+    for (uint32_t i = 0; i < exp->frames; i++) {
+        struct frame *frame = &exp->sent[i];
+        memset(frame, 0, sizeof(*frame));
+        frame->seq = i;
+        frame->len = FRAME_PAYLOAD_BYTES;
+        frame->flags = i + 1 == exp->frames? FRAME_FLAG_LAST: 0;
+        for (int b = 0; b < FRAME_PAYLOAD_BYTES; b++) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            frame->payload[b] = state >> 56;
+        }
+    }
+}
+
+static void *run_sender(void *arg)
+{
+    struct experiment *exp = arg;
+    const struct config *config = exp->sender;
+    uint64_t start_t = send_preamble(next_slot(config), config);
+    if (!exp->frames) {
+        send_bits(&exp->raw, start_t, config);
+        return NULL;
+    }
+
+    struct bitstream wire;
+    bs_init(&wire);
+    for (uint32_t i = 0; i < exp->frames; i++) {
+        start_t = send_frame(&exp->sent[i], &wire, start_t, config);
+    }
+    bs_free(&wire);
+    return NULL;
+}
+
+static void *run_receiver(void *arg)
+{
+    struct experiment *exp = arg;
+    struct config *config = exp->receiver;
+    struct symbol_clock clk;
+    clock_init(&clk, config);
+    wait_preamble(config, &clk);
+    exp->start_t = rdtsc();
+    train_levels(config, &clk);
+
+    if (!exp->frames) {
+        struct symbol_sample sample;
+        while (exp->received.nbits < exp->raw.nbits) {
+            receive_symbol(config, &clk, &sample);
+            for (uint32_t b = 0; b < symbol_bits(config); b++) {
+                exp->soft[exp->received.nbits + b] = fec_soft_from_llr(sample.llr[b]);
+            }
+            bs_push_bits(&exp->received, sample.symbol, symbol_bits(config));
+        }
+        exp->end_t = rdtsc();
+        return NULL;
+    }
+
+    struct frame frame;
+    for (uint32_t i = 0; i < exp->frames; i++) {
+        int ret = receive_frame(config, &clk, exp->soft, &frame);
+        const struct frame *sent = &exp->sent[i];
+        enum outcome outcome = FrameOk;
+        if (ret < 0) {
+            outcome = FrameLost;
+        } else if (ret == 0) {
+            outcome = FrameCorrupt;
+        } else if (frame.seq != sent->seq || frame.len != sent->len ||
+                   memcmp(frame.payload, sent->payload, frame.len) != 0) {
+            outcome = FrameUndetected;
+        }
+        exp->outcomes[outcome]++;
+        exp->end_t = rdtsc();
+    }
+    return NULL;
+}
+
+/*
+ * Returns the number of slots the sender needs for the experiment.
+ */
+static uint64_t experiment_slots(const struct experiment *exp, const struct config *config)
+{
+    uint64_t slots = 12;
+    if (config->levels > 2) {
+        slots += CHANNEL_TRAINING_REPEATS * config->levels;
+    }
+    if (exp->frames) {
+        return slots + (uint64_t) exp->frames * frame_slots(config);
+    }
+    uint64_t symbols = (exp->raw.nbits + symbol_bits(config) - 1) / symbol_bits(config);
+    return slots + symbols * (config->manchester? 2: 1);
+}
+
+/*
+ * Initializes config from the channel options, as the sender or receiver
+ * binaries would. Their output only shows with -v.
+ */
+static void init_side(struct config *config, bool sender, int argc, char **argv, bool verbose)
+{
+    int saved = -1;
+    if (!verbose) {
+        fflush(stdout);
+        saved = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    optind = 0;
+    init_default(config, argc, argv);
+    if (sender) {
+        tx_init(config, getpid());
+    } else {
+        rx_init(config, getpid());
+    }
+
+    if (!verbose) {
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+    if (config->arq || config->probe_cpu >= 0) {
+        fprintf(stderr, "ERROR: -A and -d are not supported by the simulator\n");
+        exit(-1);
+    }
+}
+
+static Replacement parse_policy(const char *arg)
+{
+    if (strcmp(arg, "lru") == 0)
+        return ReplaceLRU;
+    if (strcmp(arg, "plru") == 0)
+        return ReplacePLRU;
+    if (strcmp(arg, "qlru") == 0)
+        return ReplaceQLRU;
+    fprintf(stderr, "ERROR: unknown replacement policy %s (lru, plru or qlru)\n", arg);
+    exit(-1);
+}
+
+/*
+ * Sets the LLC of the model from "sets,ways,slices".
+ */
+static void parse_geometry(const char *arg)
+{
+    uint32_t sets, ways, slices;
+    if (sscanf(arg, "%u,%u,%u", &sets, &ways, &slices) != 3 || !slices || sets % slices ||
+        __builtin_popcount(sets / slices) != 1) {
+        fprintf(stderr, "ERROR: -g takes sets,ways,slices with a power of two sets per slice\n");
+        exit(-1);
+    }
+    geometry.l3_sets = sets;
+    geometry.l3_ways = ways;
+    geometry.l3_slices = slices;
+    geometry.l3_slice_sets = sets / slices;
+}
+
+static void print_usage()
+{
+    printf("Usage: ccsim [options] [-- sender/receiver options]\n");
+    printf("-n: (uint) runs, each with its own seed\n");
+    printf("-S: (uint) seed of the first run\n");
+    printf("-b: (uint) random bits to send per run\n");
+    printf("-f: (uint) random frames to send per run instead of bits\n");
+    printf("-R: (lru, plru or qlru) replacement policy of the caches\n");
+    printf("-g: (sets,ways,slices) geometry of the LLC\n");
+    printf("-N: (double) foreign fills per LLC set and million cycles\n");
+    printf("-J: (double) deviation of the timed accesses, in cycles\n");
+    printf("-X: (double) interrupts per agent and million cycles\n");
+    printf("-q: (uint) cycles of a lockstep quantum\n");
+    printf("-v: to show the channel setup\n");
+    printf("-h: to print this message\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct sim_params params = { .policy = ReplaceLRU, .quantum = SIM_DEFAULT_QUANTUM };
+    uint32_t runs = 1, bits = CCSIM_DEFAULT_BITS, frames = 0;
+    uint64_t seed = 1;
+    bool verbose = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:S:b:f:R:g:N:J:X:q:vh")) != -1) {
+        switch (option) {
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            case 'S':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'b':
+                bits = atoi(optarg);
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'R':
+                params.policy = parse_policy(optarg);
+                break;
+            case 'g':
+                parse_geometry(optarg);
+                break;
+            case 'N':
+                params.noise_rate = atof(optarg);
+                break;
+            case 'J':
+                params.jitter = atof(optarg);
+                break;
+            case 'X':
+                params.irq_rate = atof(optarg);
+                break;
+            case 'q':
+                params.quantum = strtoull(optarg, NULL, 0);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            case 'h':
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+    if (runs == 0 || bits == 0 || params.quantum == 0) {
+        fprintf(stderr, "ERROR: -n, -b and -q have to be positive\n");
+        exit(-1);
+    }
+
+    // the channel options follow, parsed once per side
+    int side_argc = argc - optind + 1;
+    char **side_argv = argv + optind - 1;
+    side_argv[0] = argv[0];
+
+    geometry.source = "simulator";
+    sim_init(&params);
+    struct config sender, receiver;
+    init_side(&sender, true, side_argc, side_argv, verbose);
+    init_side(&receiver, false, side_argc, side_argv, verbose);
+
+    struct experiment exp = { .sender = &sender, .receiver = &receiver, .frames = frames };
+    bs_init(&exp.payload);
+    bs_init(&exp.raw);
+    bs_init(&exp.received);
+    bs_init(&exp.decoded);
+    if (frames) {
+        exp.sent = malloc(frames * sizeof(*exp.sent));
+        exp.soft = malloc(frame_wire_bits(sender.fec));
+    } else {
+        exp.payload_bits = fec_payload_bits(sender.fec, bits);
+        exp.soft = malloc(bits + 64);      // the last symbol may run past bits
+    }
+
+    printf("%s, %s, FEC %s, LLC %u sets x %u ways in %u slices, %s replacement\n",
+           channel_names[sender.channel], frames? "frames": "bits", fec_name(sender.fec),
+           geometry.l3_sets, geometry.l3_ways, geometry.l3_slices,
+           params.policy == ReplaceLRU? "LRU": params.policy == ReplacePLRU? "tree-PLRU": "QLRU");
+    if (frames) {
+        printf("%6s %18s %8s %8s %8s %10s %14s\n", "run", "seed", "ok", "corrupt", "lost",
+               "undetected", "goodput");
+    } else {
+        printf("%6s %18s %10s %14s %14s\n", "run", "seed", "raw BER", "post-FEC BER", "goodput");
+    }
+
+    double sum_ber = 0, sum_post = 0, sum_goodput = 0;
+    uint32_t totals[FRAME_OUTCOMES] = { 0 }, expired = 0;
+    struct timespec beg_t, end_t;
+    clock_gettime(CLOCK_MONOTONIC, &beg_t);
+    for (uint32_t i = 0; i < runs; i++) {
+        exp.seed = seed + i;
+        exp.start_t = exp.end_t = 0;
+        memset(exp.outcomes, 0, sizeof(exp.outcomes));
+        bs_clear(&exp.received);
+        bs_clear(&exp.decoded);
+        if (frames) {
+            random_frames(&exp);
+        } else {
+            bs_clear(&exp.payload);
+            bs_clear(&exp.raw);
+            generate_random_msg(&exp.payload, exp.payload_bits, CHANNEL_BENCHMARK_SEED ^ exp.seed);
+            fec_encode(sender.fec, &exp.payload, &exp.raw);
+            while (exp.raw.nbits < bits) {
+                bs_push(&exp.raw, 0);
+            }
+        }
+
+        sim_reset(exp.seed, sender.channel == L1DPrimeProbe);
+        uint64_t deadline = (experiment_slots(&exp, &sender) + CCSIM_MARGIN_SLOTS) * sender.interval +
+                            CHANNEL_SLOT_GUARD;
+        sim_run(run_sender, run_receiver, &exp, deadline);
+        bool lost = sim_expired(SIM_RECEIVER);
+        expired += lost;
+
+        double seconds = (exp.end_t - exp.start_t) / SIM_TSC_HZ;
+        double goodput = 0;
+        if (frames) {
+            // whatever the receiver did not get to is lost
+            uint32_t seen = 0;
+            for (int o = 0; o < FRAME_OUTCOMES; o++) {
+                seen += exp.outcomes[o];
+            }
+            exp.outcomes[FrameLost] += frames - seen;
+            for (int o = 0; o < FRAME_OUTCOMES; o++) {
+                totals[o] += exp.outcomes[o];
+            }
+            goodput = seconds > 0? exp.outcomes[FrameOk] * FRAME_PAYLOAD_BYTES * 8 / seconds: 0;
+            printf("%6u %18lu %8u %8u %8u %10u %12.1f/s%s\n", i, exp.seed,
+                   exp.outcomes[FrameOk], exp.outcomes[FrameCorrupt], exp.outcomes[FrameLost],
+                   exp.outcomes[FrameUndetected], goodput, lost? " (timed out)": "");
+        } else {
+            // missing bits count as errors
+            uint32_t raw_errors = 0, payload_errors = 0;
+            for (uint32_t b = 0; b < bits; b++) {
+                raw_errors += b >= exp.received.nbits || bs_get(&exp.received, b) != bs_get(&exp.raw, b);
+            }
+            if (exp.received.nbits >= bits) {
+                fec_decode_soft(sender.fec, exp.soft, bits, exp.payload_bits, &exp.decoded);
+                for (uint32_t b = 0; b < exp.payload_bits; b++) {
+                    payload_errors += bs_get(&exp.decoded, b) != bs_get(&exp.payload, b);
+                }
+            } else {
+                payload_errors = exp.payload_bits;
+            }
+            double ber = (double) raw_errors / bits;
+            double post = (double) payload_errors / exp.payload_bits;
+            goodput = seconds > 0? (exp.payload_bits - payload_errors) / seconds: 0;
+            sum_ber += ber;
+            sum_post += post;
+            printf("%6u %18lu %10.6f %14.6f %12.1f/s%s\n", i, exp.seed, ber, post, goodput,
+                   lost? " (timed out)": "");
+        }
+        sum_goodput += goodput;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_t);
+    double wall = (end_t.tv_sec - beg_t.tv_sec) + (end_t.tv_nsec - beg_t.tv_nsec) / 1e9;
+
+    if (frames) {
+        printf("total:");
+        for (int o = 0; o < FRAME_OUTCOMES; o++) {
+            printf(" %u %s", totals[o], outcome_names[o]);
+        }
+        printf(" of %u frames, mean goodput %.1f bits/s\n", runs * frames, sum_goodput / runs);
+    } else {
+        printf("mean: raw BER %.6f, post-FEC BER %.6f, goodput %.1f bits/s\n",
+               sum_ber / runs, sum_post / runs, sum_goodput / runs);
+    }
+    if (expired) {
+        printf("%u runs timed out before the receiver was done\n", expired);
+    }
+    printf("%u runs in %.2f s, %.0f experiments per minute\n", runs, wall, runs * 60 / wall);
+
+    bs_free(&exp.payload);
+    bs_free(&exp.raw);
+    bs_free(&exp.received);
+    bs_free(&exp.decoded);
+    free(exp.sent);
+    free(exp.soft);
+    return 0;
+}
@@ -0,0 +1,215 @@
+#include "util.h"
+
+/*
+ * Empties the given eviction set.
+ */
+void evset_reset(struct evset *set)
+{
+    set->head = 0;
+    set->tail = 0;
+    set->size = 0;
+}
+
+/*
+ * Makes a single-line set without writing to the line, so that it can be
+ * used on read-only mappings.
+ */
+void evset_single(struct evset *set, ADDR_PTR addr)
+{
+    set->head = addr;
+    set->tail = addr;
+    set->size = 1;
+}
+
+/*
+ * Appends a line to the set in O(1) by linking it after the tail, and
+ * closes the ring back to the head, both ways.
+ */
+void evset_append(struct evset *set, ADDR_PTR addr)
+{
+    if (set->size == 0) {
+        set->head = addr;
+    } else {
+        *(ADDR_PTR *) set->tail = addr;
+    }
+    *(ADDR_PTR *) addr = set->head;
+    *((ADDR_PTR *) addr + 1) = set->size? set->tail: addr;
+    *((ADDR_PTR *) set->head + 1) = addr;
+    set->tail = addr;
+    set->size++;
+}
+
+/*
+ * Relinks the lines of the set in a pseudo-random order derived from seed,
+ * so that walking the set defeats the stride prefetchers.
+ * A seed of 0 keeps the lines in the order they were appended.
+ */
+void evset_shuffle(struct evset *set, uint64_t seed)
+{
+    if (seed == 0 || set->size < 2)
+        return;
+
+    ADDR_PTR *lines = malloc(set->size * sizeof(*lines));
+    ADDR_PTR addr = set->head;
+    for (uint32_t i = 0; i < set->size; i++) {
+        lines[i] = addr;
+        addr = evset_next(addr);
+    }
+
+    // Fisher-Yates with a xorshift64 generator
+    uint64_t state = seed;
+    for (uint32_t i = set->size - 1; i > 0; i--) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint32_t j = state % (i + 1);
+        ADDR_PTR tmp = lines[i];
+        lines[i] = lines[j];
+        lines[j] = tmp;
+    }
+
+    uint32_t size = set->size;
+    evset_reset(set);
+    for (uint32_t i = 0; i < size; i++) {
+        evset_append(set, lines[i]);
+    }
+    free(lines);
+}
+
+/*
+ * Tests whether walking the given lines evicts victim from the LLC, by
+ * majority vote over EVSET_TEST_ROUNDS rounds.
+ */
+static bool evset_evicts(ADDR_PTR victim, const ADDR_PTR *lines, uint32_t n,
+                         uint64_t threshold)
+{
+    uint32_t evictions = 0;
+    for (uint32_t round = 0; round < EVSET_TEST_ROUNDS; round++) {
+        load_line(victim);
+        for (uint32_t rep = 0; rep < 2; rep++) {
+            for (uint32_t i = 0; i < n; i++) {
+                load_line(lines[i]);
+            }
+        }
+        evictions += measure_one_block_access_time(victim) > threshold;
+    }
+    return evictions * 2 > EVSET_TEST_ROUNDS;
+}
+
+/*
+ * Reduces lines (which evict victim) to a minimal eviction set of ways lines
+ * by group testing: split the lines into ways + 1 groups, at least one of
+ * which can be dropped while the rest still evicts victim.
+ * Returns the number of lines left at the front of lines, which is ways on
+ * success.
+ */
+static uint32_t evset_reduce(ADDR_PTR victim, ADDR_PTR *lines, uint32_t n,
+                             uint32_t ways, uint64_t threshold)
+{
+    ADDR_PTR *rest = malloc(n * sizeof(*rest));
+    uint32_t backtracks = 0;
+
+    while (n > ways) {
+        uint32_t groups = n < ways + 1? n: ways + 1;
+        uint32_t dropped = 0;
+        for (uint32_t g = 0; g < groups && !dropped; g++) {
+            uint32_t begin = (uint64_t) n * g / groups;
+            uint32_t end = (uint64_t) n * (g + 1) / groups;
+            memcpy(rest, lines, begin * sizeof(*rest));
+            memcpy(rest + begin, lines + end, (n - end) * sizeof(*rest));
+            if (evset_evicts(victim, rest, n - (end - begin), threshold)) {
+                dropped = end - begin;
+                memcpy(lines, rest, (n - dropped) * sizeof(*rest));
+            }
+        }
+        // A noisy test may have dropped a congruent line, give up after a
+        // few attempts instead of spinning on a set that no longer evicts
+        if (!dropped && ++backtracks > EVSET_MAX_BACKTRACKS)
+            break;
+        n -= dropped;
+    }
+
+    free(rest);
+    return n;
+}
+
+/*
+ * Discovers minimal eviction sets of as many lines as LLC ways among the candidate
+ * lines, which should all share the set index bits known from the page
+ * offset. Each minimal set found is congruent with a different slice (or
+ * unknown physical set bits); the lines of up to max_slices of them are
+ * appended to set, and the line each one evicts to victims unless NULL.
+ * The candidates array is reordered. Returns the number of minimal sets found.
+ */
+uint32_t evset_discover(struct evset *set, uint32_t max_slices, ADDR_PTR *candidates,
+                        uint32_t n, uint64_t threshold, ADDR_PTR *victims)
+{
+    uint32_t found = 0;
+    ADDR_PTR *work = malloc(n * sizeof(*work));
+
+    while (found < max_slices && n > geometry.l3_ways) {
+        // take the last candidate as the victim
+        ADDR_PTR victim = candidates[--n];
+
+        // grow the pool until it evicts the victim, smaller pools reduce faster
+        uint32_t pool = 2 * geometry.l3_ways;
+        while (pool < n && !evset_evicts(victim, candidates, pool, threshold))
+            pool *= 2;
+        if (pool > n) pool = n;
+        if (!evset_evicts(victim, candidates, pool, threshold))
+            continue;
+
+        memcpy(work, candidates, pool * sizeof(*work));
+        if (evset_reduce(victim, work, pool, geometry.l3_ways, threshold) != geometry.l3_ways)
+            continue;
+
+        // drop the new set and every remaining candidate congruent with it
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            bool member = false;
+            for (uint32_t j = 0; j < geometry.l3_ways; j++) {
+                member |= candidates[i] == work[j];
+            }
+            if (!member && !evset_evicts(candidates[i], work, geometry.l3_ways, threshold))
+                candidates[kept++] = candidates[i];
+        }
+        debug("eviction set %u found from a pool of %u, %u candidates left\n",
+              found, pool, kept);
+        n = kept;
+
+        for (uint32_t i = 0; i < geometry.l3_ways; i++) {
+            evset_append(set, work[i]);
+        }
+        if (victims) {
+            victims[found] = victim;
+        }
+        found++;
+    }
+
+    free(work);
+    return found;
+}
+
+/*
+ * Rebuilds a set found by evset_discover from the lines of each minimal set,
+ * preceded by its victim, when every minimal set still evicts its victim.
+ * Returns the number of minimal sets restored, 0 (and an empty set) if any
+ * of them no longer evicts.
+ */
+uint32_t evset_restore(struct evset *set, const ADDR_PTR *lines, uint32_t n,
+                       uint64_t threshold)
+{
+    uint32_t group = geometry.l3_ways + 1;
+    if (n == 0 || n % group)
+        return 0;
+    for (uint32_t i = 0; i < n; i += group) {
+        if (!evset_evicts(lines[i], lines + i + 1, geometry.l3_ways, threshold))
+            return 0;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (i % group) {
+            evset_append(set, lines[i]);
+        }
+    }
+    return n / group;
+}
@@ -0,0 +1,60 @@
+#ifndef EVSET_H_
+#define EVSET_H_
+
+// Included from util.h, which provides ADDR_PTR and the standard headers.
+
+/*
+ * An eviction set lives inside the buffer it is built from: the first word
+ * of each line holds the address of the next line, and the last line points
+ * back to the head. Walking the set therefore touches only its own lines,
+ * in the (shuffled) order the links were laid out. The second word links
+ * back to the previous line, so that the set can be walked in reverse.
+ *
+ * Sets over read-only memory (e.g. a F+R mapping) cannot hold links and
+ * are limited to a single line.
+ */
+struct evset {
+    ADDR_PTR head;
+    ADDR_PTR tail;
+    uint32_t size;
+};
+
+/*
+ * Returns the line following addr in its eviction set.
+ */
+static inline __attribute__((always_inline))
+ADDR_PTR evset_next(ADDR_PTR addr) {
+#ifdef SIMULATOR
+    sim_load(addr);
+#endif
+    return *(volatile ADDR_PTR *) addr;
+}
+
+/*
+ * Returns the line preceding addr in its eviction set.
+ */
+static inline __attribute__((always_inline))
+ADDR_PTR evset_prev(ADDR_PTR addr) {
+#ifdef SIMULATOR
+    sim_load(addr);
+#endif
+    return *((volatile ADDR_PTR *) addr + 1);
+}
+
+void evset_reset(struct evset *set);
+void evset_single(struct evset *set, ADDR_PTR addr);
+void evset_append(struct evset *set, ADDR_PTR addr);
+void evset_shuffle(struct evset *set, uint64_t seed);
+
+// Timing-based discovery of minimal eviction sets
+#define EVSET_TEST_ROUNDS       8
+#define EVSET_MAX_BACKTRACKS    8
+#define EVSET_MAX_SLICES        64
+#define EVSET_POOL_LINES        (32 * geometry.l3_ways)    // candidates per region
+
+uint32_t evset_discover(struct evset *set, uint32_t max_slices, ADDR_PTR *candidates,
+                        uint32_t n, uint64_t threshold, ADDR_PTR *victims);
+uint32_t evset_restore(struct evset *set, const ADDR_PTR *lines, uint32_t n,
+                       uint64_t threshold);
+
+#endif
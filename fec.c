@@ -0,0 +1,526 @@
+#include "util.h"
+
+static const char *fec_names[] = { "none", "hamming", "conv", "rs" };
+
+/*
+ * Returns the code named by name (or its number), -1 if unknown.
+ */
+Fec fec_parse(const char *name)
+{
+    for (int i = 0; i < (int) (sizeof(fec_names) / sizeof(*fec_names)); i++) {
+        if (strcmp(name, fec_names[i]) == 0)
+            return i;
+    }
+    if (name[0] >= '0' && name[0] <= '3' && name[1] == '\0')
+        return name[0] - '0';
+    return -1;
+}
+
+const char *fec_name(Fec fec)
+{
+    return fec_names[fec];
+}
+
+static bool fec_interleaved(Fec fec)
+{
+    return fec == FecHamming || fec == FecConvolutional;
+}
+
+/*
+ * Returns the number of coded bits for payload_bits bits of payload,
+ * before interleaving.
+ */
+static size_t fec_codeword_bits(Fec fec, size_t payload_bits)
+{
+    size_t bytes = (payload_bits + 7) / 8;
+    switch (fec) {
+        case FecHamming:
+            return (payload_bits + 3) / 4 * 7;
+        case FecConvolutional:
+            return 2 * (payload_bits + FEC_CONV_K - 1);
+        case FecReedSolomon:
+            return 8 * (bytes + FEC_RS_PARITY * ((bytes + FEC_RS_K - 1) / FEC_RS_K));
+        case FecNone:
+        default:
+            return payload_bits;
+    }
+}
+
+/*
+ * Returns the number of bits on the wire for payload_bits bits of payload.
+ */
+size_t fec_coded_bits(Fec fec, size_t payload_bits)
+{
+    size_t bits = fec_codeword_bits(fec, payload_bits);
+    if (fec_interleaved(fec))
+        bits = (bits + FEC_INTERLEAVE_DEPTH - 1) / FEC_INTERLEAVE_DEPTH * FEC_INTERLEAVE_DEPTH;
+    return bits;
+}
+
+/*
+ * Returns the largest payload whose coding fits in coded_bits bits.
+ */
+size_t fec_payload_bits(Fec fec, size_t coded_bits)
+{
+    size_t payload_bits = coded_bits;
+    while (payload_bits > 0 && fec_coded_bits(fec, payload_bits) > coded_bits)
+        payload_bits--;
+    return payload_bits;
+}
+
+// =======================================
+// Block interleaver
+// =======================================
+
+/*
+ * Returns the position on the wire of coded bit i out of n (a multiple of
+ * FEC_INTERLEAVE_DEPTH): bits are written row by row and read column by column.
+ */
+static inline size_t interleave_index(size_t i, size_t n)
+{
+    size_t cols = n / FEC_INTERLEAVE_DEPTH;
+    return (i % cols) * FEC_INTERLEAVE_DEPTH + i / cols;
+}
+
+// =======================================
+// Hamming(7,4)
+// =======================================
+
+static void hamming_encode(const struct bitstream *payload, uint8_t *coded)
+{
+    for (size_t i = 0; i < payload->nbits; i += 4) {
+        uint32_t d = bs_get_bits(payload, i, 4);
+        uint8_t d1 = d & 1, d2 = (d >> 1) & 1, d3 = (d >> 2) & 1, d4 = (d >> 3) & 1;
+        // codeword positions 1..7 are p1 p2 d1 p3 d2 d3 d4
+        uint8_t *c = coded + i / 4 * 7;
+        c[0] = d1 ^ d2 ^ d4;
+        c[1] = d1 ^ d3 ^ d4;
+        c[2] = d1;
+        c[3] = d2 ^ d3 ^ d4;
+        c[4] = d2;
+        c[5] = d3;
+        c[6] = d4;
+    }
+}
+
+/*
+ * Picks the codeword closest to the soft bits. On hard bits this is
+ * plain syndrome decoding, as the code is perfect.
+ */
+static void hamming_decode(const uint8_t *soft, size_t payload_bits, struct bitstream *payload)
+{
+    static uint8_t codewords[16][7];
+    if (codewords[15][6] == 0) {
+        struct bitstream d;
+        bs_init(&d);
+        for (uint64_t v = 0; v < 16; v++) {
+            bs_push_bits(&d, v, 4);
+        }
+        hamming_encode(&d, codewords[0]);
+        bs_free(&d);
+    }
+
+    for (size_t i = 0; i < payload_bits; i += 4) {
+        const uint8_t *r = soft + i / 4 * 7;
+        uint32_t best_cost = UINT32_MAX;
+        uint64_t best = 0;
+        for (uint64_t v = 0; v < 16; v++) {
+            uint32_t cost = 0;
+            for (int j = 0; j < 7; j++) {
+                cost += codewords[v][j]? FEC_SOFT_ONE - r[j]: r[j];
+            }
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = v;
+            }
+        }
+        bs_push_bits(payload, best, payload_bits - i < 4? payload_bits - i: 4);
+    }
+}
+
+// =======================================
+// Convolutional code with Viterbi decoding
+// =======================================
+
+#define CONV_STATES (1 << (FEC_CONV_K - 1))
+
+static void conv_encode(const struct bitstream *payload, uint8_t *coded)
+{
+    uint32_t reg = 0;
+    // the K-1 tail bits flush the encoder back to state 0
+    for (size_t i = 0; i < payload->nbits + FEC_CONV_K - 1; i++) {
+        uint32_t bit = i < payload->nbits? bs_get(payload, i): 0;
+        reg = ((reg << 1) | bit) & ((1 << FEC_CONV_K) - 1);
+        coded[2 * i] = __builtin_parity(reg & FEC_CONV_POLY_A);
+        coded[2 * i + 1] = __builtin_parity(reg & FEC_CONV_POLY_B);
+    }
+}
+
+/*
+ * Maximum-likelihood decoding over the trellis, with the branch metric being
+ * the distance between the expected bits and the soft received bits.
+ */
+static void conv_decode(const uint8_t *soft, size_t payload_bits, struct bitstream *payload)
+{
+    size_t steps = payload_bits + FEC_CONV_K - 1;
+    uint64_t *decisions = malloc(steps * sizeof(*decisions));
+    uint32_t metric[CONV_STATES], next[CONV_STATES];
+
+    for (uint32_t s = 0; s < CONV_STATES; s++) {
+        metric[s] = s == 0? 0: UINT32_MAX / 2;
+    }
+
+    for (size_t t = 0; t < steps; t++) {
+        uint32_t r0 = soft[2 * t], r1 = soft[2 * t + 1];
+        uint64_t decision = 0;
+        for (uint32_t n = 0; n < CONV_STATES; n++) {
+            // state n is reached from (n >> 1) with the dropped bit x on top,
+            // the encoder register then holds x followed by n
+            uint32_t best = UINT32_MAX;
+            for (uint32_t x = 0; x < 2; x++) {
+                uint32_t reg = (x << (FEC_CONV_K - 1)) | n;
+                uint32_t prev = (n >> 1) | (x << (FEC_CONV_K - 2));
+                uint32_t a = __builtin_parity(reg & FEC_CONV_POLY_A);
+                uint32_t b = __builtin_parity(reg & FEC_CONV_POLY_B);
+                uint32_t cost = metric[prev] + (a? FEC_SOFT_ONE - r0: r0) + (b? FEC_SOFT_ONE - r1: r1);
+                if (cost < best) {
+                    best = cost;
+                    decision = (decision & ~(1ULL << n)) | ((uint64_t) x << n);
+                }
+            }
+            next[n] = best;
+        }
+        decisions[t] = decision;
+        memcpy(metric, next, sizeof(metric));
+    }
+
+    // trace back from state 0, where the tail bits left the encoder
+    uint8_t *bits = malloc(steps);
+    uint32_t state = 0;
+    for (size_t t = steps; t-- > 0;) {
+        bits[t] = state & 1;
+        uint32_t x = (decisions[t] >> state) & 1;
+        state = (state >> 1) | (x << (FEC_CONV_K - 2));
+    }
+    for (size_t i = 0; i < payload_bits; i++) {
+        bs_push(payload, bits[i]);
+    }
+
+    free(bits);
+    free(decisions);
+}
+
+// =======================================
+// Reed-Solomon over GF(2^8)
+// =======================================
+
+static uint8_t gf_exp[2 * FEC_RS_N];
+static uint8_t gf_log[FEC_RS_N + 1];
+static uint8_t rs_generator[FEC_RS_PARITY + 1];
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    return a && b? gf_exp[gf_log[a] + gf_log[b]]: 0;
+}
+
+static inline uint8_t gf_div(uint8_t a, uint8_t b)
+{
+    return a? gf_exp[gf_log[a] + FEC_RS_N - gf_log[b]]: 0;
+}
+
+static inline uint8_t gf_pow_alpha(int power)
+{
+    power %= FEC_RS_N;
+    return gf_exp[power < 0? power + FEC_RS_N: power];
+}
+
+/*
+ * Evaluates p(x) = p[0] + p[1] x + ... + p[deg] x^deg.
+ */
+static uint8_t gf_poly_eval(const uint8_t *p, int deg, uint8_t x)
+{
+    uint8_t y = 0;
+    for (int i = deg; i >= 0; i--) {
+        y = gf_mul(y, x) ^ p[i];
+    }
+    return y;
+}
+
+static void rs_init(void)
+{
+    if (gf_exp[0])
+        return;
+
+    // primitive polynomial x^8 + x^4 + x^3 + x^2 + 1
+    uint32_t x = 1;
+    for (int i = 0; i < FEC_RS_N; i++) {
+        gf_exp[i] = gf_exp[i + FEC_RS_N] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11d;
+    }
+
+    // g(x) = (x - a^0)(x - a^1)...(x - a^31), highest degree first
+    memset(rs_generator, 0, sizeof(rs_generator));
+    rs_generator[0] = 1;
+    for (int i = 0; i < FEC_RS_PARITY; i++) {
+        for (int j = i + 1; j > 0; j--) {
+            rs_generator[j] ^= gf_mul(rs_generator[j - 1], gf_exp[i]);
+        }
+    }
+}
+
+/*
+ * Appends the parity of the k data bytes in block[0..k) to block[k..k+32).
+ */
+static void rs_encode_block(uint8_t *block, int k)
+{
+    uint8_t *parity = block + k;
+    memset(parity, 0, FEC_RS_PARITY);
+    for (int i = 0; i < k; i++) {
+        uint8_t feedback = block[i] ^ parity[0];
+        memmove(parity, parity + 1, FEC_RS_PARITY - 1);
+        parity[FEC_RS_PARITY - 1] = 0;
+        for (int j = 0; j < FEC_RS_PARITY; j++) {
+            parity[j] ^= gf_mul(feedback, rs_generator[j + 1]);
+        }
+    }
+}
+
+/*
+ * Corrects up to 16 byte errors in place in the n byte codeword block,
+ * block[0] being the coefficient of the highest degree.
+ * Returns the number of corrected bytes, or -1 if the block is uncorrectable.
+ */
+static int rs_decode_block(uint8_t *block, int n)
+{
+    uint8_t syndromes[FEC_RS_PARITY];
+    bool clean = true;
+    for (int j = 0; j < FEC_RS_PARITY; j++) {
+        uint8_t s = 0;
+        for (int i = 0; i < n; i++) {
+            s = gf_mul(s, gf_exp[j]) ^ block[i];
+        }
+        syndromes[j] = s;
+        clean &= s == 0;
+    }
+    if (clean)
+        return 0;
+
+    // Berlekamp-Massey for the error locator
+    uint8_t lambda[FEC_RS_PARITY + 1] = {1}, prev[FEC_RS_PARITY + 1] = {1};
+    uint8_t tmp[FEC_RS_PARITY + 1];
+    int errors = 0, shift = 1;
+    uint8_t prev_discrepancy = 1;
+    for (int r = 0; r < FEC_RS_PARITY; r++) {
+        uint8_t discrepancy = syndromes[r];
+        for (int i = 1; i <= errors; i++) {
+            discrepancy ^= gf_mul(lambda[i], syndromes[r - i]);
+        }
+        if (discrepancy == 0) {
+            shift++;
+            continue;
+        }
+        uint8_t coef = gf_div(discrepancy, prev_discrepancy);
+        memcpy(tmp, lambda, sizeof(tmp));
+        for (int i = 0; i + shift <= FEC_RS_PARITY; i++) {
+            lambda[i + shift] ^= gf_mul(coef, prev[i]);
+        }
+        if (2 * errors <= r) {
+            errors = r + 1 - errors;
+            memcpy(prev, tmp, sizeof(prev));
+            prev_discrepancy = discrepancy;
+            shift = 1;
+        } else {
+            shift++;
+        }
+    }
+    if (errors > FEC_RS_PARITY / 2)
+        return -1;
+
+    // error evaluator omega = syndromes * lambda mod x^32
+    uint8_t omega[FEC_RS_PARITY] = {0};
+    for (int i = 0; i < FEC_RS_PARITY; i++) {
+        for (int j = 0; j <= i && j <= errors; j++) {
+            omega[i] ^= gf_mul(syndromes[i - j], lambda[j]);
+        }
+    }
+
+    // Chien search for the roots, then Forney for the magnitudes
+    uint8_t fixes[FEC_RS_N];
+    int positions[FEC_RS_N], found = 0;
+    for (int i = 0; i < n; i++) {
+        int power = n - 1 - i;
+        uint8_t x_inv = gf_pow_alpha(-power);
+        if (gf_poly_eval(lambda, errors, x_inv) != 0)
+            continue;
+
+        uint8_t derivative = 0;
+        for (int j = 1; j <= errors; j += 2) {
+            derivative ^= gf_mul(lambda[j], gf_pow_alpha(-power * (j - 1)));
+        }
+        if (derivative == 0)
+            return -1;
+        uint8_t magnitude = gf_div(gf_poly_eval(omega, FEC_RS_PARITY - 1, x_inv), derivative);
+        fixes[found] = gf_mul(gf_pow_alpha(power), magnitude);
+        positions[found++] = i;
+    }
+    if (found != errors)
+        return -1;
+
+    for (int i = 0; i < found; i++) {
+        block[positions[i]] ^= fixes[i];
+    }
+    return found;
+}
+
+static void rs_encode(const struct bitstream *payload, uint8_t *coded)
+{
+    size_t bytes = (payload->nbits + 7) / 8;
+    uint8_t block[FEC_RS_N];
+    size_t c = 0;
+
+    rs_init();
+    for (size_t i = 0; i < bytes; i += FEC_RS_K) {
+        int k = bytes - i < FEC_RS_K? bytes - i: FEC_RS_K;
+        memset(block, 0, sizeof(block));
+        bs_to_bytes(payload, i * 8, block, k);
+        // a trailing partial byte is zero padded
+        if ((i + k) * 8 > payload->nbits) {
+            size_t pos = (i + k - 1) * 8;
+            for (size_t b = pos; b < payload->nbits; b++) {
+                block[k - 1] |= bs_get(payload, b) << (7 - (b - pos));
+            }
+        }
+        rs_encode_block(block, k);
+        for (int j = 0; j < k + FEC_RS_PARITY; j++) {
+            for (int b = 7; b >= 0; b--) {
+                coded[c++] = (block[j] >> b) & 1;
+            }
+        }
+    }
+}
+
+static void rs_decode(const uint8_t *soft, size_t payload_bits, struct bitstream *payload)
+{
+    size_t bytes = (payload_bits + 7) / 8;
+    uint8_t block[FEC_RS_N];
+    size_t c = 0;
+
+    rs_init();
+    for (size_t i = 0; i < bytes; i += FEC_RS_K) {
+        int k = bytes - i < FEC_RS_K? bytes - i: FEC_RS_K;
+        for (int j = 0; j < k + FEC_RS_PARITY; j++) {
+            block[j] = 0;
+            for (int b = 0; b < 8; b++) {
+                block[j] = (block[j] << 1) | (soft[c++] >= FEC_SOFT_HALF);
+            }
+        }
+        // uncorrectable blocks are passed on as received
+        rs_decode_block(block, k + FEC_RS_PARITY);
+        for (int j = 0; j < k; j++) {
+            size_t left = payload_bits - (i + j) * 8;
+            uint32_t n = left < 8? left: 8;
+            for (uint32_t b = 0; b < n; b++) {
+                bs_push(payload, (block[j] >> (7 - b)) & 1);
+            }
+        }
+    }
+}
+
+// =======================================
+// Encoder and decoder entry points
+// =======================================
+
+/*
+ * Appends the coded and interleaved payload to coded.
+ */
+void fec_encode(Fec fec, const struct bitstream *payload, struct bitstream *coded)
+{
+    size_t codeword_bits = fec_codeword_bits(fec, payload->nbits);
+    size_t wire_bits = fec_coded_bits(fec, payload->nbits);
+    uint8_t *bits = calloc(wire_bits + 8, 1);
+
+    switch (fec) {
+        case FecHamming:
+            hamming_encode(payload, bits);
+            break;
+        case FecConvolutional:
+            conv_encode(payload, bits);
+            break;
+        case FecReedSolomon:
+            rs_encode(payload, bits);
+            break;
+        case FecNone:
+        default:
+            for (size_t i = 0; i < payload->nbits; i++) {
+                bits[i] = bs_get(payload, i);
+            }
+    }
+
+    size_t base = coded->nbits;
+    bs_reserve(coded, base + wire_bits);
+    for (size_t i = 0; i < wire_bits; i++) {
+        bs_push(coded, 0);
+    }
+    for (size_t i = 0; i < codeword_bits; i++) {
+        size_t j = fec_interleaved(fec)? interleave_index(i, wire_bits): i;
+        if (bits[i])
+            coded->words[(base + j) >> 6] |= 1ULL << ((base + j) & 63);
+    }
+
+    free(bits);
+}
+
+/*
+ * Maps the log-likelihood ratio of a one (positive favours one)
+ * to a soft bit. A ratio of zero reads as a zero, like the hard decision.
+ */
+uint8_t fec_soft_from_llr(double llr)
+{
+    if (llr > 20)
+        return FEC_SOFT_ONE;
+    if (llr < -20)
+        return 0;
+    long soft = lround(FEC_SOFT_ONE / (1 + exp(-llr)));
+    if (llr <= 0 && soft >= FEC_SOFT_HALF)
+        return FEC_SOFT_HALF - 1;
+    return soft;
+}
+
+/*
+ * Decodes payload_bits of payload from n soft bits in wire order and
+ * appends them to payload. Missing soft bits count as erasures.
+ */
+void fec_decode_soft(Fec fec, const uint8_t *wire, size_t n,
+                     size_t payload_bits, struct bitstream *payload)
+{
+    size_t codeword_bits = fec_codeword_bits(fec, payload_bits);
+    size_t wire_bits = fec_coded_bits(fec, payload_bits);
+    uint8_t *soft = calloc(wire_bits + 8, 1);
+
+    for (size_t i = 0; i < codeword_bits; i++) {
+        size_t j = fec_interleaved(fec)? interleave_index(i, wire_bits): i;
+        soft[i] = j < n? wire[j]: FEC_SOFT_HALF;
+    }
+
+    switch (fec) {
+        case FecHamming:
+            hamming_decode(soft, payload_bits, payload);
+            break;
+        case FecConvolutional:
+            conv_decode(soft, payload_bits, payload);
+            break;
+        case FecReedSolomon:
+            rs_decode(soft, payload_bits, payload);
+            break;
+        case FecNone:
+        default:
+            for (size_t i = 0; i < payload_bits; i++) {
+                bs_push(payload, soft[i] >= FEC_SOFT_HALF);
+            }
+    }
+
+    free(soft);
+}
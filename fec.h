@@ -0,0 +1,41 @@
+#ifndef FEC_H_
+#define FEC_H_
+
+// Included from util.h, which provides the standard headers and bits.h.
+
+typedef enum _fec {
+    FecNone = 0,
+    FecHamming,         // Hamming(7,4)
+    FecConvolutional,   // K=7, rate 1/2 (0171, 0133), Viterbi decoded
+    FecReedSolomon      // RS(255,223) over bytes, shortened for short blocks
+} Fec;
+
+// Rows of the block interleaver spreading bursts of bit errors
+// across codewords of the bit-oriented codes
+#define FEC_INTERLEAVE_DEPTH    16
+
+/*
+ * Soft bits are confidences in 0 (surely zero) to 255 (surely one);
+ * hard-decision decoders threshold them at the middle.
+ */
+#define FEC_SOFT_ONE            255
+#define FEC_SOFT_HALF           128
+
+#define FEC_CONV_K              7
+#define FEC_CONV_POLY_A         0171
+#define FEC_CONV_POLY_B         0133
+
+#define FEC_RS_N                255
+#define FEC_RS_PARITY           32
+#define FEC_RS_K                (FEC_RS_N - FEC_RS_PARITY)
+
+Fec fec_parse(const char *name);
+const char *fec_name(Fec fec);
+size_t fec_coded_bits(Fec fec, size_t payload_bits);
+size_t fec_payload_bits(Fec fec, size_t coded_bits);
+void fec_encode(Fec fec, const struct bitstream *payload, struct bitstream *coded);
+uint8_t fec_soft_from_llr(double llr);
+void fec_decode_soft(Fec fec, const uint8_t *wire, size_t n,
+                     size_t payload_bits, struct bitstream *payload);
+
+#endif
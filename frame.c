@@ -0,0 +1,91 @@
+#include "util.h"
+
+static uint32_t crc32_table[256];
+
+/*
+ * Updates crc with len bytes of data (CRC-32, reflected polynomial
+ * 0xEDB88320). Start from 0 and chain calls to checksum a stream.
+ */
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    if (crc32_table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; j++) {
+                c = c & 1? 0xEDB88320 ^ (c >> 1): c >> 1;
+            }
+            crc32_table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/*
+ * Returns the number of bits of a frame on the wire, resync word included.
+ */
+size_t frame_wire_bits(Fec fec)
+{
+    return FRAME_SYNC_BITS + fec_coded_bits(fec, FRAME_BODY_BYTES * 8);
+}
+
+/*
+ * Appends the resync word and the coded body of frame to wire.
+ */
+void frame_encode(const struct frame *frame, Fec fec, struct bitstream *wire)
+{
+    uint8_t body[FRAME_BODY_BYTES];
+    body[0] = frame->seq >> 8;
+    body[1] = frame->seq & 0xff;
+    body[2] = frame->len;
+    body[3] = frame->flags;
+    memcpy(body + FRAME_HEADER_BYTES, frame->payload, FRAME_PAYLOAD_BYTES);
+
+    uint32_t crc = crc32(0, body, FRAME_HEADER_BYTES + FRAME_PAYLOAD_BYTES);
+    for (int i = 0; i < FRAME_CRC_BYTES; i++) {
+        body[FRAME_BODY_BYTES - 1 - i] = crc >> (8 * i);
+    }
+
+    for (int i = FRAME_SYNC_BITS - 1; i >= 0; i--) {
+        bs_push(wire, (FRAME_SYNC_WORD >> i) & 1);
+    }
+
+    struct bitstream plain;
+    bs_init(&plain);
+    bs_push_bytes(&plain, body, FRAME_BODY_BYTES);
+    fec_encode(fec, &plain, wire);
+    bs_free(&plain);
+}
+
+/*
+ * Decodes the frame body from the soft bits received after the resync word,
+ * frame_wire_bits(fec) - FRAME_SYNC_BITS of them.
+ * Returns false if the CRC does not match, the frame is then to be dropped.
+ */
+bool frame_decode(const uint8_t *soft, Fec fec, struct frame *frame)
+{
+    uint8_t body[FRAME_BODY_BYTES];
+    struct bitstream plain;
+    bs_init(&plain);
+    fec_decode_soft(fec, soft, frame_wire_bits(fec) - FRAME_SYNC_BITS,
+                    FRAME_BODY_BYTES * 8, &plain);
+    bs_to_bytes(&plain, 0, body, FRAME_BODY_BYTES);
+    bs_free(&plain);
+
+    uint32_t crc = 0;
+    for (int i = 0; i < FRAME_CRC_BYTES; i++) {
+        crc = (crc << 8) | body[FRAME_HEADER_BYTES + FRAME_PAYLOAD_BYTES + i];
+    }
+    if (crc != crc32(0, body, FRAME_HEADER_BYTES + FRAME_PAYLOAD_BYTES))
+        return false;
+
+    frame->seq = (body[0] << 8) | body[1];
+    frame->len = body[2];
+    frame->flags = body[3];
+    memcpy(frame->payload, body + FRAME_HEADER_BYTES, FRAME_PAYLOAD_BYTES);
+    return frame->len <= FRAME_PAYLOAD_BYTES;
+}
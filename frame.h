@@ -0,0 +1,38 @@
+#ifndef FRAME_H_
+#define FRAME_H_
+
+// Included from util.h, which provides the standard headers, bits.h and fec.h.
+
+/*
+ * On the wire a frame is the uncoded resync word followed by the (FEC coded)
+ * body: a header with the sequence number, payload length and flags, a
+ * fixed-size payload and a CRC-32 over header and payload.
+ * Frames follow each other on the slot schedule; the resync word tells
+ * when the receiver lost the sender.
+ */
+#define FRAME_SYNC_WORD         0xEB90  // sent MSB first, starts with a one
+#define FRAME_SYNC_BITS         16
+#define FRAME_HEADER_BYTES      4
+#define FRAME_PAYLOAD_BYTES     32
+#define FRAME_CRC_BYTES         4
+#define FRAME_BODY_BYTES        (FRAME_HEADER_BYTES + FRAME_PAYLOAD_BYTES + FRAME_CRC_BYTES)
+#define FRAME_SYNC_TOLERANCE    2       // bit errors accepted in the resync word
+#define FRAME_MAX_SYNC_MISSES   4       // lost frames before hunting the preamble again
+
+#define FRAME_FLAG_LAST         0x01    // last frame of a message
+#define FRAME_FLAG_ACK          0x02    // ARQ acknowledgement, from the receiver
+
+struct frame {
+    uint16_t seq;
+    uint8_t len;
+    uint8_t flags;
+    uint8_t payload[FRAME_PAYLOAD_BYTES];
+};
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+size_t frame_wire_bits(Fec fec);
+void frame_encode(const struct frame *frame, Fec fec, struct bitstream *wire);
+bool frame_decode(const uint8_t *soft, Fec fec, struct frame *frame);
+
+#endif
@@ -0,0 +1,213 @@
+#include "util.h"
+#include <cpuid.h>
+
+// what the machines this was first written for have, used when undetected
+struct geometry geometry = {
+    .line_size = CACHE_LINESIZE,
+    .l1_sets = 64, .l1_ways = 8,
+    .l2_sets = 1024, .l2_ways = 8,
+    .l3_sets = 32768, .l3_ways = 20,
+    .l3_slices = 16,
+    .l3_slice_sets = GEOMETRY_SLICE_SETS,
+    .hugepage_size = 2 << 20,
+    .source = "built-in defaults",
+};
+
+static void set_level(uint32_t level, uint32_t sets, uint32_t ways, uint32_t line_size)
+{
+    if (level == 1) {
+        geometry.l1_sets = sets;
+        geometry.l1_ways = ways;
+        geometry.line_size = line_size;
+    } else if (level == 2) {
+        geometry.l2_sets = sets;
+        geometry.l2_ways = ways;
+    } else if (level == 3) {
+        geometry.l3_sets = sets;
+        geometry.l3_ways = ways;
+    }
+}
+
+/*
+ * Reads the deterministic cache parameters, returns a bit mask of the
+ * levels found.
+ */
+static uint32_t detect_cpuid()
+{
+    unsigned int eax, ebx, ecx, edx;
+    char vendor[13] = {0};
+    // no CPUID, sysfs or the defaults have to do
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+        return 0;
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+
+    unsigned int leaf = 4;
+    if (strcmp(vendor, "AuthenticAMD") == 0) {
+        leaf = 0x8000001d;
+        if (__get_cpuid_max(0x80000000, NULL) < leaf)
+            return 0;
+    } else if (__get_cpuid_max(0, NULL) < leaf) {
+        return 0;
+    }
+
+    uint32_t found = 0;
+    for (unsigned int index = 0; index < 16; index++) {
+        __cpuid_count(leaf, index, eax, ebx, ecx, edx);
+        uint32_t type = eax & 0x1f, level = (eax >> 5) & 0x7;
+        if (type == 0)
+            break;
+        if (type == 2)      // instruction cache
+            continue;
+        set_level(level, ecx + 1, ((ebx >> 22) & 0x3ff) + 1, (ebx & 0xfff) + 1);
+        found |= 1 << level;
+    }
+    return found;
+}
+
+static bool read_sysfs(const char *dir, const char *name, char *value, size_t len)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    bool ok = fgets(value, len, f) != NULL;
+    fclose(f);
+    value[strcspn(value, "\n")] = '\0';
+    return ok;
+}
+
+/*
+ * Returns the number of CPUs in a list such as "0-3,8-11".
+ */
+static uint32_t count_cpu_list(const char *list)
+{
+    uint32_t count = 0;
+    while (*list) {
+        char *end;
+        unsigned long first = strtoul(list, &end, 10), last = first;
+        if (end == list)
+            break;
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+        count += last - first + 1;
+        list = *end == ',' ? end + 1: end;
+    }
+    return count;
+}
+
+/*
+ * Completes the levels CPUID did not report from sysfs, and returns the
+ * number of cores sharing the LLC (0 if unknown).
+ */
+static uint32_t detect_sysfs(uint32_t *found)
+{
+    char dir[128], value[256];
+    uint32_t llc_cpus = 0, llc_level = 0;
+    for (int index = 0; index < 16; index++) {
+        snprintf(dir, sizeof(dir), "/sys/devices/system/cpu/cpu0/cache/index%d", index);
+        if (!read_sysfs(dir, "level", value, sizeof(value)))
+            break;
+        uint32_t level = atoi(value);
+        if (!read_sysfs(dir, "type", value, sizeof(value)) || strcmp(value, "Instruction") == 0)
+            continue;
+
+        if (level >= llc_level && read_sysfs(dir, "shared_cpu_list", value, sizeof(value))) {
+            llc_level = level;
+            llc_cpus = count_cpu_list(value);
+        }
+        if (*found & (1 << level))
+            continue;
+        char sets[32], ways[32], line[32];
+        if (read_sysfs(dir, "number_of_sets", sets, sizeof(sets)) &&
+            read_sysfs(dir, "ways_of_associativity", ways, sizeof(ways)) &&
+            read_sysfs(dir, "coherency_line_size", line, sizeof(line)) &&
+            atoi(sets) > 0 && atoi(ways) > 0) {
+            set_level(level, atoi(sets), atoi(ways), atoi(line));
+            *found |= 1 << level;
+        }
+    }
+
+    // one slice per core, not per hyperthread
+    uint32_t threads = 1;
+    if (read_sysfs("/sys/devices/system/cpu/cpu0/topology", "thread_siblings_list",
+                   value, sizeof(value))) {
+        threads = count_cpu_list(value);
+    }
+    return threads? llc_cpus / threads: llc_cpus;
+}
+
+/*
+ * Splits the LLC in slices: one per core sharing it when that gives a
+ * power-of-two number of sets per slice, otherwise slices of
+ * GEOMETRY_SLICE_SETS sets as on most Intel parts.
+ */
+static void derive_slices(uint32_t cores)
+{
+    uint32_t sets = geometry.l3_sets;
+    if (cores > 0 && sets % cores == 0 && ((sets / cores) & (sets / cores - 1)) == 0) {
+        geometry.l3_slices = cores;
+    } else if (sets % GEOMETRY_SLICE_SETS == 0) {
+        geometry.l3_slices = sets / GEOMETRY_SLICE_SETS;
+    } else {
+        geometry.l3_slices = 1;
+    }
+    geometry.l3_slice_sets = sets / geometry.l3_slices;
+    // the slice set index is a bit mask, keep it a power of two
+    while (geometry.l3_slice_sets & (geometry.l3_slice_sets - 1)) {
+        geometry.l3_slice_sets &= geometry.l3_slice_sets - 1;
+    }
+}
+
+static uint64_t detect_hugepage_size()
+{
+    FILE *f = fopen("/proc/meminfo", "r");
+    char line[128];
+    uint64_t kb = 0;
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+            break;
+    }
+    if (f)
+        fclose(f);
+    return kb? kb << 10: geometry.hugepage_size;
+}
+
+/*
+ * Fills the global geometry, keeping the built-in defaults for anything
+ * that cannot be detected.
+ */
+void geometry_detect()
+{
+#ifdef SIMULATOR
+    // set up by the simulator, whatever the host has
+    return;
+#endif
+    uint32_t found = detect_cpuid();
+    geometry.source = found? "CPUID": "built-in defaults";
+    uint32_t from_cpuid = found;
+    uint32_t cores = detect_sysfs(&found);
+    if (found != from_cpuid) {
+        geometry.source = from_cpuid? "CPUID and sysfs": "sysfs";
+    }
+    derive_slices(cores);
+    geometry.hugepage_size = detect_hugepage_size();
+
+    if (geometry.line_size != CACHE_LINESIZE) {
+        fprintf(stderr, "WARNING: cache lines of %u bytes, the channel assumes %d\n",
+                geometry.line_size, CACHE_LINESIZE);
+    }
+}
+
+void geometry_print()
+{
+    printf("Cache geometry (%s):\n", geometry.source);
+    printf("  L1D %u sets x %u ways, L2 %u sets x %u ways, %u-byte lines\n",
+           geometry.l1_sets, geometry.l1_ways, geometry.l2_sets, geometry.l2_ways,
+           geometry.line_size);
+    printf("  LLC %u sets x %u ways in %u slices of %u sets\n",
+           geometry.l3_sets, geometry.l3_ways, geometry.l3_slices, geometry.l3_slice_sets);
+    printf("  huge pages of %lu KiB\n", geometry.hugepage_size >> 10);
+}
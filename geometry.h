@@ -0,0 +1,30 @@
+#ifndef GEOMETRY_H_
+#define GEOMETRY_H_
+
+// Included from util.h, which provides the standard headers.
+
+/*
+ * Cache geometry of the host, detected at startup from CPUID (leaf 4, or
+ * 0x8000001D on AMD) and completed from /sys/devices/system/cpu/cpu0/cache.
+ * The LLC is split in slices of a power-of-two number of sets, indexed by
+ * the low address bits, and selected by a hash of the others.
+ */
+#define GEOMETRY_SLICE_SETS     2048    // sets per LLC slice when it cannot be derived
+
+struct geometry {
+    uint32_t line_size;
+    uint32_t l1_sets, l1_ways;          // L1 data cache
+    uint32_t l2_sets, l2_ways;
+    uint32_t l3_sets, l3_ways;          // whole LLC
+    uint32_t l3_slices;
+    uint32_t l3_slice_sets;             // power of two
+    uint64_t hugepage_size;
+    const char *source;                 // where the cache parameters came from
+};
+
+extern struct geometry geometry;
+
+void geometry_detect();
+void geometry_print();
+
+#endif
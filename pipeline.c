@@ -0,0 +1,129 @@
+#define _GNU_SOURCE     // CPU_SET, pthread_attr_setaffinity_np
+#include "util.h"
+#include <sched.h>
+
+/*
+ * Detects the symbol of every slot on the schedule and hands it over to the
+ * decoder. The early-late gate of the clock is fed here, with the level
+ * means the receiver started with: only the decoder trains them.
+ */
+static void *probe_loop(void *arg)
+{
+    struct sample_ring *ring = arg;
+    const struct config *config = &ring->config;
+    struct symbol_sample overflow;
+    struct symbol_clock clk;
+    clock_init(&clk, config);
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (!atomic_load_explicit(&ring->stop, memory_order_relaxed)) {
+        if (head - ring->tail_cache == PIPELINE_RING_SLOTS) {
+            ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        }
+        bool full = head - ring->tail_cache == PIPELINE_RING_SLOTS;
+        struct ring_entry *entry = &ring->entries[head % PIPELINE_RING_SLOTS];
+        struct symbol_sample *sample = full? &overflow: &entry->sample;
+
+        uint64_t slot = clk.slot;
+        detect_symbol(config, clock_start(&clk, config), sample);
+        clock_tick(&clk, sample, config);
+        if (full) {
+            ring->dropped++;
+            continue;
+        }
+        entry->slot = slot;
+        atomic_store_explicit(&ring->head, ++head, memory_order_release);
+    }
+    return NULL;
+}
+
+/*
+ * Starts the probe thread on cpu and moves the calling thread, the decoder,
+ * to the other cores it may run on. The probe thread only gets real-time
+ * priority when the decoder has a core of its own, as it never sleeps.
+ */
+struct sample_ring *pipeline_start(const struct config *config, int cpu)
+{
+    struct sample_ring *ring = aligned_alloc(64, sizeof(*ring));
+    if (!ring) {
+        fprintf(stderr, "ERROR: cannot allocate the sample ring\n");
+        exit(-1);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->config = *config;
+    ring->cpu = cpu;
+
+    cpu_set_t decoder;
+    if (sched_getaffinity(0, sizeof(decoder), &decoder) == -1) {
+        fprintf(stderr, "ERROR: cannot get the cores of the receiver: %s\n", strerror(errno));
+        exit(-1);
+    }
+    CPU_CLR(cpu, &decoder);
+    bool shared = CPU_COUNT(&decoder) == 0;
+    if (shared) {
+        fprintf(stderr, "WARNING: no other core to decode on, sharing core %d with the probe thread\n",
+                cpu);
+    } else if (sched_setaffinity(0, sizeof(decoder), &decoder) == -1) {
+        fprintf(stderr, "ERROR: cannot move the decoder off core %d: %s\n", cpu, strerror(errno));
+        exit(-1);
+    }
+
+    cpu_set_t probe;
+    CPU_ZERO(&probe);
+    CPU_SET(cpu, &probe);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(probe), &probe);
+    int err = pthread_create(&ring->thread, &attr, probe_loop, ring);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        fprintf(stderr, "ERROR: cannot start the probe thread on core %d: %s\n", cpu, strerror(err));
+        exit(-1);
+    }
+
+    struct sched_param param = { .sched_priority = sched_get_priority_max(SCHED_FIFO) };
+    if (!shared && (err = pthread_setschedparam(ring->thread, SCHED_FIFO, &param))) {
+        fprintf(stderr, "WARNING: probe thread is not real-time: %s\n", strerror(err));
+    }
+    return ring;
+}
+
+/*
+ * Waits for the sample of the slot starting at slot. Returns false if the
+ * probe thread dropped it, sample then holds an erasure. Samples of earlier
+ * slots, from before the decoder started, are skipped.
+ */
+bool pipeline_sample(struct sample_ring *ring, uint64_t slot, struct symbol_sample *sample)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (true) {
+        while (tail == ring->head_cache) {
+            ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+            if (tail == ring->head_cache)
+                sched_yield();
+        }
+
+        const struct ring_entry *entry = &ring->entries[tail % PIPELINE_RING_SLOTS];
+        if (entry->slot > slot) {
+            memset(sample, 0, sizeof(*sample));
+            return false;
+        }
+        bool found = entry->slot == slot;
+        if (found) {
+            *sample = entry->sample;
+        }
+        atomic_store_explicit(&ring->tail, ++tail, memory_order_release);
+        if (found)
+            return true;
+    }
+}
+
+void pipeline_stop(struct sample_ring *ring)
+{
+    atomic_store_explicit(&ring->stop, true, memory_order_relaxed);
+    pthread_join(ring->thread, NULL);
+    if (ring->dropped) {
+        printf("decoder fell behind, %lu samples dropped\n", ring->dropped);
+    }
+    free(ring);
+}
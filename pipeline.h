@@ -0,0 +1,44 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+// Included from util.h after rx.h, which provides the standard headers.
+#include <stdatomic.h>
+
+/*
+ * Splits the receiver in two threads: a probe thread pinned to its own core
+ * (real-time when allowed) that only detects the symbol of every slot, and
+ * the decoder, which runs the preamble hunt, training, FEC, framing and
+ * output on the other cores. The samples go through a single-producer,
+ * single-consumer ring whose indices sit on cache lines of their own, so
+ * the probe loop never waits on the decoder. When the ring is full the probe
+ * thread drops the sample and the decoder reads an erasure in its place.
+ */
+#define PIPELINE_RING_SLOTS     1024    // power of two
+
+struct ring_entry {
+    uint64_t slot;                      // start of the slot on the shared grid
+    struct symbol_sample sample;
+};
+
+struct sample_ring {
+    // written by the probe thread, a cache line each side
+    __attribute__((aligned(64))) _Atomic uint64_t head;
+    uint64_t tail_cache;                // last tail seen
+    uint64_t dropped;
+
+    // written by the decoder
+    __attribute__((aligned(64))) _Atomic uint64_t tail;
+    uint64_t head_cache;                // last head seen
+    _Atomic bool stop;
+
+    __attribute__((aligned(64))) struct config config;   // copy for the probe thread
+    int cpu;
+    pthread_t thread;
+    struct ring_entry entries[PIPELINE_RING_SLOTS];
+};
+
+struct sample_ring *pipeline_start(const struct config *config, int cpu);
+bool pipeline_sample(struct sample_ring *ring, uint64_t slot, struct symbol_sample *sample);
+void pipeline_stop(struct sample_ring *ring);
+
+#endif
@@ -0,0 +1,307 @@
+#include "util.h"
+#include <cpuid.h>
+#include <sys/file.h>
+
+/*
+ * Parses "role region offset..." of an evset line.
+ */
+static void parse_evset(char *p, const char *path, uint32_t n, struct profile *profile)
+{
+    char role[16];
+    uint64_t region;
+    int used;
+    if (sscanf(p, "%15s %lu%n", role, &region, &used) != 2) {
+        fprintf(stderr, "ERROR: %s:%u: expected a role and a region\n", path, n);
+        exit(-1);
+    }
+    if (profile->evsets == PROFILE_MAX_EVSETS) {
+        fprintf(stderr, "ERROR: %s:%u: more than %d eviction sets\n", path, n,
+                PROFILE_MAX_EVSETS);
+        exit(-1);
+    }
+
+    struct profile_evset *evset = &profile->evset[profile->evsets++];
+    *evset = (struct profile_evset) { .region = region };
+    strcpy(evset->role, role);
+    uint32_t capacity = 0;
+    p += used;
+    for (char *end; ; p = end) {
+        uint64_t offset = strtoull(p, &end, 0);
+        if (end == p)
+            break;
+        if (evset->n == capacity) {
+            capacity = capacity? 2 * capacity: 64;
+            evset->offsets = realloc(evset->offsets, capacity * sizeof(uint64_t));
+        }
+        evset->offsets[evset->n++] = offset;
+    }
+}
+
+static void profile_parse(FILE *f, const char *path, struct profile *profile)
+{
+    char *line = NULL, key[64];
+    size_t size = 0;
+    double value;
+    for (uint32_t n = 1; getline(&line, &size, f) != -1; n++) {
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+        if (strncmp(p, "evset ", 6) == 0) {
+            parse_evset(p + 6, path, n, profile);
+            continue;
+        }
+        if (sscanf(p, "%63s %lf", key, &value) != 2 || value < 0) {
+            fprintf(stderr, "ERROR: %s:%u: expected a key and a value\n", path, n);
+            exit(-1);
+        }
+
+        if (strcmp(key, "interval") == 0) {
+            profile->interval = value;
+        } else if (strcmp(key, "prime_period") == 0) {
+            profile->prime_period = value;
+        } else if (strcmp(key, "access_period") == 0) {
+            profile->access_period = value;
+        } else if (strcmp(key, "bandwidth") == 0) {
+            profile->bandwidth = value;
+        } else if (strcmp(key, "capacity") == 0) {
+            profile->capacity = value;
+        } else if (strcmp(key, "version") == 0) {
+            profile->version = value;
+            if (profile->version > PROFILE_VERSION) {
+                fprintf(stderr, "ERROR: %s: profile version %u is newer than %d\n",
+                        path, profile->version, PROFILE_VERSION);
+                exit(-1);
+            }
+        } else if (strcmp(key, "cpu") == 0) {
+            profile->host.cpu = value;
+        } else if (strcmp(key, "microcode") == 0) {
+            profile->host.microcode = value;
+        } else if (strcmp(key, "hugepage_size") == 0) {
+            profile->host.hugepage_size = value;
+        } else if (strcmp(key, "hugepages") == 0) {
+            profile->host.hugepages = value;
+        } else if (strcmp(key, "tsc_hz") == 0) {
+            profile->tsc_hz = value;
+        } else if (strcmp(key, "l1_miss_threshold") == 0) {
+            profile->calib.l1_miss_threshold = value;
+        } else if (strcmp(key, "l3_miss_threshold") == 0) {
+            profile->calib.l3_miss_threshold = value;
+            profile->calibrated = true;
+        } else if (strcmp(key, "outlier_threshold") == 0) {
+            profile->calib.outlier_threshold = value;
+        } else if (strcmp(key, "flush_threshold") == 0) {
+            profile->calib.flush_threshold = value;
+        } else if (strcmp(key, "l1_latency") == 0) {
+            profile->calib.l1_latency = value;
+        } else if (strcmp(key, "llc_latency") == 0) {
+            profile->calib.llc_latency = value;
+        } else if (strcmp(key, "dram_latency") == 0) {
+            profile->calib.dram_latency = value;
+        } else {
+            fprintf(stderr, "ERROR: %s:%u: unknown key %s\n", path, n, key);
+            exit(-1);
+        }
+    }
+    free(line);
+}
+
+/*
+ * Reads the profile at path, fields it does not set keep their value.
+ * Returns false if there is no such file.
+ */
+bool profile_read(const char *path, struct profile *profile)
+{
+    FILE *f = fopen(path, "r");
+    if (!f && errno == ENOENT)
+        return false;
+    if (!f) {
+        fprintf(stderr, "ERROR: cannot open profile %s: %s\n", path, strerror(errno));
+        exit(-1);
+    }
+    profile_parse(f, path, profile);
+    fclose(f);
+    return true;
+}
+
+static void profile_print(FILE *f, const char *path, const struct profile *profile)
+{
+    fprintf(f, "# covert-channel profile, load with -P %s\n", path);
+    fprintf(f, "version %d\n", PROFILE_VERSION);
+    // not tuned yet, the options or defaults apply
+    if (profile->interval) {
+        fprintf(f, "# channel timing tuned by ccbench\n");
+        fprintf(f, "interval %lu\n", profile->interval);
+        fprintf(f, "prime_period %lu\n", profile->prime_period);
+        fprintf(f, "access_period %lu\n", profile->access_period);
+        fprintf(f, "bandwidth %.1f\n", profile->bandwidth);
+        fprintf(f, "capacity %.4f\n", profile->capacity);
+    }
+    if (!profile->calibrated)
+        return;
+
+    fprintf(f, "# calibration, reused on this host while it passes a check\n");
+    fprintf(f, "cpu 0x%x\n", profile->host.cpu);
+    fprintf(f, "microcode 0x%x\n", profile->host.microcode);
+    fprintf(f, "hugepage_size %lu\n", profile->host.hugepage_size);
+    fprintf(f, "hugepages %lu\n", profile->host.hugepages);
+    fprintf(f, "tsc_hz %.0f\n", profile->tsc_hz);
+    fprintf(f, "l1_miss_threshold %lu\n", profile->calib.l1_miss_threshold);
+    fprintf(f, "l3_miss_threshold %lu\n", profile->calib.l3_miss_threshold);
+    fprintf(f, "outlier_threshold %lu\n", profile->calib.outlier_threshold);
+    fprintf(f, "flush_threshold %lu\n", profile->calib.flush_threshold);
+    fprintf(f, "l1_latency %lu\n", profile->calib.l1_latency);
+    fprintf(f, "llc_latency %lu\n", profile->calib.llc_latency);
+    fprintf(f, "dram_latency %lu\n", profile->calib.dram_latency);
+    for (uint32_t i = 0; i < profile->evsets; i++) {
+        const struct profile_evset *evset = &profile->evset[i];
+        fprintf(f, "evset %s %lu", evset->role, evset->region);
+        for (uint32_t j = 0; j < evset->n; j++) {
+            fprintf(f, " %lu", evset->offsets[j]);
+        }
+        fprintf(f, "\n");
+    }
+}
+
+/*
+ * Drops the eviction sets of the profile.
+ */
+void profile_free_evsets(struct profile *profile)
+{
+    for (uint32_t i = 0; i < profile->evsets; i++) {
+        free(profile->evset[i].offsets);
+    }
+    profile->evsets = 0;
+}
+
+/*
+ * Stores what this run measured (profile->dirty) into the profile at path,
+ * keeping the rest of the file. The file is re-read under a lock, so that a
+ * sender and a receiver sharing it keep each other's eviction sets.
+ */
+void profile_save(const char *path, const struct profile *profile)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    FILE *f = fd < 0 || flock(fd, LOCK_EX) != 0? NULL: fdopen(fd, "r+");
+    if (!f) {
+        fprintf(stderr, "ERROR: cannot write profile %s: %s\n", path, strerror(errno));
+        exit(-1);
+    }
+    struct profile *saved = calloc(1, sizeof(*saved));
+    profile_parse(f, path, saved);
+
+    if (profile->dirty & PROFILE_TIMING) {
+        saved->interval = profile->interval;
+        saved->prime_period = profile->prime_period;
+        saved->access_period = profile->access_period;
+        saved->bandwidth = profile->bandwidth;
+        saved->capacity = profile->capacity;
+    }
+    if (profile->dirty & PROFILE_CALIBRATION) {
+        bool same_host = saved->calibrated && profile_host_equal(&saved->host, &profile->host);
+        // eviction sets of another host are meaningless here
+        if (!same_host) {
+            profile_free_evsets(saved);
+        }
+        uint64_t flush_threshold = saved->calib.flush_threshold;
+        saved->calibrated = true;
+        saved->host = profile->host;
+        saved->tsc_hz = profile->tsc_hz;
+        saved->calib = profile->calib;
+        if (same_host && profile->calib.flush_threshold == 0) {
+            saved->calib.flush_threshold = flush_threshold;
+        }
+    }
+    if (profile->dirty & PROFILE_EVSETS) {
+        for (uint32_t i = 0; i < profile->evsets; i++) {
+            const struct profile_evset *evset = &profile->evset[i];
+            if (evset->fresh) {
+                profile_set_evset(saved, evset->role, evset->region, evset->offsets, evset->n);
+            }
+        }
+    }
+
+    rewind(f);
+    if (ftruncate(fd, 0) != 0) {
+        fprintf(stderr, "ERROR: cannot write profile %s: %s\n", path, strerror(errno));
+        exit(-1);
+    }
+    profile_print(f, path, saved);
+    if (fclose(f) != 0) {
+        fprintf(stderr, "ERROR: cannot write profile %s: %s\n", path, strerror(errno));
+        exit(-1);
+    }
+    profile_free_evsets(saved);
+    free(saved);
+}
+
+/*
+ * Identifies the host: calibration measured on a different CPU, microcode
+ * or huge page pool is not reused.
+ */
+void profile_host(struct profile_host *host)
+{
+    unsigned int eax = 0, ebx, ecx, edx;
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    *host = (struct profile_host) {
+        .cpu = eax,
+        .hugepage_size = geometry.hugepage_size,
+    };
+
+    char line[256];
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "microcode : %x", &host->microcode) == 1)
+            break;
+    }
+    if (f)
+        fclose(f);
+
+    f = fopen("/proc/meminfo", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "HugePages_Total: %lu", &host->hugepages) == 1)
+            break;
+    }
+    if (f)
+        fclose(f);
+}
+
+bool profile_host_equal(const struct profile_host *a, const struct profile_host *b)
+{
+    return a->cpu == b->cpu && a->microcode == b->microcode &&
+           a->hugepage_size == b->hugepage_size && a->hugepages == b->hugepages;
+}
+
+/*
+ * Returns the eviction sets of a region for role, or NULL.
+ */
+const struct profile_evset *profile_evset(const struct profile *profile, const char *role,
+                                          uint64_t region)
+{
+    for (uint32_t i = 0; i < profile->evsets; i++) {
+        if (profile->evset[i].region == region && strcmp(profile->evset[i].role, role) == 0)
+            return &profile->evset[i];
+    }
+    return NULL;
+}
+
+/*
+ * Adds or replaces the eviction sets of a region for role with a copy of
+ * offsets, marked as discovered by this run.
+ */
+void profile_set_evset(struct profile *profile, const char *role, uint64_t region,
+                       const uint64_t *offsets, uint32_t n)
+{
+    struct profile_evset *evset = (struct profile_evset *) profile_evset(profile, role, region);
+    if (!evset && profile->evsets == PROFILE_MAX_EVSETS)
+        return;
+    if (!evset) {
+        evset = &profile->evset[profile->evsets++];
+        *evset = (struct profile_evset) { .region = region };
+        snprintf(evset->role, sizeof(evset->role), "%s", role);
+    }
+    evset->offsets = realloc(evset->offsets, n * sizeof(uint64_t));
+    memcpy(evset->offsets, offsets, n * sizeof(uint64_t));
+    evset->n = n;
+    evset->fresh = true;
+    profile->dirty |= PROFILE_EVSETS;
+}
@@ -0,0 +1,71 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+// Included from util.h, which provides the standard headers.
+
+/*
+ * Tuned channel timing of a host, as written by ccbench -T and loaded by
+ * the sender and receiver with -P. The file holds one "key value" pair per
+ * line, lines starting with # are comments.
+ *
+ * The sender and receiver also keep their calibration in it: the latency
+ * thresholds, the TSC frequency and the discovered eviction sets, which are
+ * only reused on the host (CPU model, microcode and huge page pool) they
+ * were measured on, and only while they pass a quick check.
+ */
+#define PROFILE_VERSION         2
+#define PROFILE_MAX_EVSETS      128     // regions of the sender and receiver
+
+// What a run measured and profile_save stores
+#define PROFILE_TIMING          (1 << 0)
+#define PROFILE_CALIBRATION     (1 << 1)
+#define PROFILE_EVSETS          (1 << 2)
+
+struct profile_host {
+    uint32_t cpu;               // CPUID 1 signature: family, model and stepping
+    uint32_t microcode;
+    uint64_t hugepage_size;
+    uint64_t hugepages;         // huge pages reserved in the pool
+};
+
+/*
+ * The minimal eviction sets of a region as offsets into the buffer they were
+ * discovered in, which starts on a huge page. For each slice, a victim line
+ * followed by the lines of the set that evicts it.
+ */
+struct profile_evset {
+    char role[16];              // "sender" or "receiver"
+    uint64_t region;
+    uint32_t n;
+    uint64_t *offsets;
+    bool fresh;                 // discovered by this run
+};
+
+struct profile {
+    uint64_t interval;
+    uint64_t prime_period;
+    uint64_t access_period;
+    double bandwidth;           // bits/s measured when tuning, 0 if unknown
+    double capacity;            // bits per region and interval
+
+    uint32_t version;
+    bool calibrated;            // the fields below are set
+    struct profile_host host;
+    double tsc_hz;
+    struct calibration calib;   // a flush_threshold of 0 was not calibrated
+    uint32_t evsets;
+    struct profile_evset evset[PROFILE_MAX_EVSETS];
+    uint32_t dirty;             // PROFILE_* measured by this run
+};
+
+bool profile_read(const char *path, struct profile *profile);
+void profile_free_evsets(struct profile *profile);
+void profile_save(const char *path, const struct profile *profile);
+void profile_host(struct profile_host *host);
+bool profile_host_equal(const struct profile_host *a, const struct profile_host *b);
+const struct profile_evset *profile_evset(const struct profile *profile, const char *role,
+                                          uint64_t region);
+void profile_set_evset(struct profile *profile, const char *role, uint64_t region,
+                       const uint64_t *offsets, uint32_t n);
+
+#endif
@@ -5,243 +5,209 @@
 * with those parameters (or the default ones if no custom flags are given).
  */
 void init_config(struct config *config, int argc, char **argv) {
-    uint64_t pid = print_pid();
-
     init_default(config, argc, argv);
 
-    if (config->channel == PrimeProbe || config->channel == L1DPrimeProbe) {
-        // 4096 L1 stride
-        int L1_way_stride = ipow(2, LOG_CACHE_SETS_L1 + LOG_CACHE_LINESIZE);
-        // (4 * 64) * 8 * 4k = 8M
-        uint64_t bsize = 512 * CACHE_WAYS_L1 * L1_way_stride;
+    uint64_t pid = print_pid();
 
-        // Allocate a buffer twice the size of the L1 cache
-        config->buffer = allocate_buffer(bsize);
+    rx_init(config, pid);
+    if (config->reverse) {
+        tx_init(config->reverse, pid);
+    }
 
-        printf("buffer pointer addr %p\n", config->buffer);
-        // Initialize the buffer to be be the non-zero page
-        for (uint32_t i = 0; i < bsize; i += 64) {
-            *(config->buffer + i) = pid;
-        }
-        // Construct the addr_set by taking the addresses that have cache set index 0
-        // There will be at least one of such addresses in our buffer.
-        uint32_t addr_set_size = 0;
-        for (int i = 0; i < 512 * CACHE_WAYS_L1 * CACHE_SETS_L1; i++) {
-            ADDR_PTR addr = (ADDR_PTR) (config->buffer + CACHE_LINESIZE * i);
-            // both of following function should work...L3 is a more restrict set
-            if (get_cache_slice_set_index(addr) == config->cache_region) {
-            // if (get_L3_cache_set_index(addr) == config->cache_region) {
-                append_string_to_linked_list(&config->addr_set, addr);
-                addr_set_size++;
-            }
-            // restrict the probing set to CACHE_WAYS_L1 to aviod self eviction
-            if (config->channel == L1DPrimeProbe && addr_set_size >= CACHE_WAYS_L1) {
-                break;
-            }
-            // more lines than private cache ways helps to put more lines
-            // into llc slices, increasing chance of to conflict with sender
-            else if (addr_set_size >= 5 * (CACHE_WAYS_L1 + CACHE_WAYS_L2)) {
-                break;
-            }
-        }
+    // keep what this run measured for the next one
+    if (config->profile_path && config->profile.dirty) {
+        profile_save(config->profile_path, &config->profile);
+    }
+}
 
-        printf("Found addr_set size of %u\n", addr_set_size);
+void benchmark_receive(struct config *config_p) {
+    // ccbench workers share their bits in memory, others save them to data/
+    struct bench_shm *shm = NULL;
+    FILE *receiverSave = NULL;
+    if (config_p->bench_shm_name) {
+        shm = bench_shm_open(config_p->bench_shm_name, false);
+    } else if (!(receiverSave = fopen("data/receiverSave", "w+"))) {
+        fprintf(stderr, "ERROR: cannot open file to save.\n"
+                "Check if data/ folder is created\n");
+        exit(-1);
     }
 
-    if (config->channel == FlushReload) {
-        int inFile = open(config->shared_filename, O_RDONLY);
-        if (inFile == -1) {
-            fprintf(stderr, "ERROR: Failed to Open File\n");
-            exit(-1);
-        }
+    // The benchmark carries symbol_bits(config) bits per interval
+    uint32_t benchmarkSize = bench_run_bits(shm, symbol_bits(config_p));
+    struct bitstream msg;
+    bs_init(&msg);
+    bs_reserve(&msg, benchmarkSize);
+    uint8_t *soft = malloc(benchmarkSize);
+    struct symbol_sample sample;
+    struct symbol_clock clk;
+    struct timespec beg_t, end_t;
 
-        size_t size = 4096;
-        config->buffer = mmap(NULL, size, PROT_READ, MAP_SHARED, inFile, 0);
-        if (config->buffer == (void*) -1 ) {
-            fprintf(stderr, "ERROR: Failed to Map Address\n");
-            exit(-1);
+    // sync once on the pilot signal, the whole message follows on the slots
+    clock_init(&clk, config_p);
+    if (config_p->probe_cpu >= 0) {
+        clk.ring = pipeline_start(config_p, config_p->probe_cpu);
+    }
+    if (shm) {
+        shm->receiver_ready = 1;
+    }
+    wait_preamble(config_p, &clk);
+    debug("pilot signal detected\n");
+    clock_gettime(CLOCK_MONOTONIC, &beg_t);
+    train_levels(config_p, &clk);
+
+    while (msg.nbits < benchmarkSize) {
+        receive_symbol(config_p, &clk, &sample);
+        for (uint32_t b = 0; b < symbol_bits(config_p); b++) {
+            soft[msg.nbits + b] = fec_soft_from_llr(sample.llr[b]);
         }
-
-        ADDR_PTR addr = (ADDR_PTR) config->buffer + config->cache_region * 64;
-        append_string_to_linked_list(&config->addr_set, addr);
-        printf("File mapped at %p and monitoring line %lx\n", config->buffer, addr);
-
+        bs_push_bits(&msg, sample.symbol, symbol_bits(config_p));
     }
-}
 
-// receiver function pointer
-bool (*detect_bit)(const struct config*);
-
-bool detect_bit_fr(const struct config *config) {
-    int misses = 0;
-    int hits = 0;
-    int total_measurements = 0;
-
-    // This is high because the misses caused by clflush
-    // usually cause an access time larger than 150 cycles
-
-    uint64_t start_t = rdtsc();
-    while ((rdtsc() - start_t) < config->interval) {
-        uint64_t time = measure_one_block_access_time(config->addr_set->addr);
-
-        // When the access time is larger than 1000 cycles,
-        // it is usually due to a disk miss. We exclude such misses
-        // because they are not caused by clflush.
-        if (time < 1000) {
-            total_measurements++;
-            if (time > config->miss_threshold) {
-                misses++;
-            } else {
-                hits++;
-            }
+    clock_gettime(CLOCK_MONOTONIC, &end_t);
+    if (clk.ring) {
+        pipeline_stop(clk.ring);
+    }
+    uint64_t nsec = (end_t.tv_sec - beg_t.tv_sec) * (long)1e9 +
+                    (end_t.tv_nsec - beg_t.tv_nsec);
+
+    // Regenerate what the sender sent to measure the error rates
+    struct bitstream payload, raw, decoded;
+    bs_init(&payload);
+    bs_init(&raw);
+    bs_init(&decoded);
+    uint32_t payloadSize = benchmark_payload(config_p, benchmarkSize, &payload, &raw);
+    fec_decode_soft(config_p->fec, soft, benchmarkSize, payloadSize, &decoded);
+
+    uint32_t raw_errors = 0, payload_errors = 0;
+    for (uint32_t i = 0; i < benchmarkSize; i++) {
+        raw_errors += bs_get(&msg, i) != bs_get(&raw, i);
+    }
+    for (uint32_t i = 0; i < payloadSize; i++) {
+        payload_errors += bs_get(&decoded, i) != bs_get(&payload, i);
+    }
+    printf("FEC %s: raw BER %.6f, post-FEC BER %.6f, goodput %.1f bits/s\n",
+           fec_name(config_p->fec), (double) raw_errors / benchmarkSize,
+           (double) payload_errors / payloadSize,
+           (payloadSize - payload_errors) * 1e9 / nsec);
+    bs_free(&payload);
+    bs_free(&raw);
+    bs_free(&decoded);
+
+    // rates come from the measured time, the interval is in TSC cycles
+    printf("received %u bits in %lu ns: %.1f bits/s, %.1f ns per interval at TSC %.1f MHz\n",
+           benchmarkSize, nsec, benchmarkSize * 1e9 / nsec,
+           config_p->interval * 1e9 / tsc_hz(), tsc_hz() / 1e6);
+
+    if (shm) {
+        memcpy(shm->received, msg.words, (benchmarkSize + 63) / 64 * 8);
+        shm->width = config_p->width;
+        shm->levels = config_p->levels;
+        shm->nbits = benchmarkSize;
+        shm->nsec = nsec;
+        shm->payload_bits = payloadSize;
+        shm->payload_errors = payload_errors;
+        shm->receiver_done = 1;
+        bench_shm_close(shm);
+    } else {
+        for (uint32_t i = 0; i < benchmarkSize; i++) {
+            fprintf(receiverSave, "%u %u\n", i, bs_get(&msg, i));
         }
-
-        // Busy loop to give time to the sender to flush the cache
-        uint64_t wait_t = rdtsc();
-        while((rdtsc() - wait_t) < config->access_period &&
-                   (rdtsc() - start_t) < config->interval);
+        fclose(receiverSave);
     }
 
-    if (misses != 0) {
-        debug("Misses: %d out of %d\n", misses, total_measurements);
-    }
+    bs_free(&msg);
+    free(soft);
+}
 
-    bool ret =  misses > (float) total_measurements / 2.0;
-    return ret;
 
-}
 /*
- * Detects a bit by repeatedly measuring the access time of the addresses in the
- * probing set and counting the number of misses for the clock length of config->interval.
- *
- * If the the first_bit argument is true, relax the strict definition of "one" and try to
- * cc_sync with the sender.
+ * Receives the frames of a message following the preamble and hands their
+ * payloads over to sink. Returns whether the last frame was received, as
+ * the reception also ends once no resync word shows up for a few frames.
  */
-// bool detect_bit(const struct config *config, uint64_t start_t)
-bool detect_bit_pp(const struct config *config)
-{
-    uint64_t start_t = get_time();
-    // debug("time %lx\n", start_t);
-
-    int misses = 0;
-    int hits = 0;
-    int total_measurements = 0;
-
-    // miss in L3
-    struct Node *current = NULL;
-
-    // prime
-    uint64_t prime_count = 0;
-    do {
-        current = config->addr_set;
-        while (current != NULL && current->next != NULL) {
-            volatile uint64_t* addr1 = (uint64_t*) current->addr;
-            volatile uint64_t* addr2 = (uint64_t*) current->next->addr;
-            *addr1;
-            *addr2;
-            *addr1;
-            *addr2;
-            current = current->next;
-            prime_count++;
+bool receive_message(const struct config *config, struct symbol_clock *clk,
+                     uint8_t *soft, uint32_t *frames,
+                     void (*sink)(void *, const uint8_t *, size_t), void *sink_arg) {
+    struct frame frame;
+    uint16_t expected_seq = 0;
+    uint32_t misses = 0;
+    bool last = false;
+
+    *frames = 0;
+    while (!last && misses < FRAME_MAX_SYNC_MISSES) {
+        int ret = receive_frame(config, clk, soft, &frame);
+        if (ret < 0) {
+            misses++;
+            continue;
         }
-    } while ((get_time() - start_t) < config->prime_period);
-    // debug("prime count%lu\n", prime_count);
-
-    // wait for sender to access
-    while (get_time() - start_t < (config->prime_period + config->access_period)) {}
-
-    // probe
-    current = config->addr_set;
-    while (current != NULL && (get_time() - start_t) < config->interval) {
-        ADDR_PTR addr = current->addr;
-        uint64_t time = measure_one_block_access_time(addr);
-
-        // When the access time is larger than 1000 cycles,
-        // it is usually due to a long-latency page walk.
-        // We exclude such misses
-        // because they are not caused by accesses from the sender.
-        total_measurements += time < 800;
-        misses  += (time < 800) && (time > config->miss_threshold);
-        hits    += (time < 800) && (time <= config->miss_threshold);
-
-        current = current->next;
-        // debug("access time %lu\n", time);
-    }
-
-    if (misses != 0) {
-        debug("Misses: %d out of %d\n", misses, total_measurements);
+        misses = 0;
+        if (ret == 0) {
+            printf("dropped corrupted frame %u\n", expected_seq++);
+            continue;
+        }
+        if (frame.seq != expected_seq) {
+            printf("lost frames %u to %u\n", expected_seq, (uint16_t) (frame.seq - 1));
+        }
+        expected_seq = frame.seq + 1;
+        (*frames)++;
+        sink(sink_arg, frame.payload, frame.len);
+        last = frame.flags & FRAME_FLAG_LAST;
     }
-
-    bool ret = (misses > CACHE_WAYS_L1 / 2 - 1)? true: false;
-    // FIXME: If only one set region used in a L1D, the channel is really not
-    // reliable as too much noise even from stack reads and writes.
-    // Mulitple regions for each channel is recommended.
-    // The hardcoded 1 miss count threshold can be used for a noisy l1d-PP
-    // bool ret = (misses > 1)? true: false;
-
-    while (get_time() - start_t < config->interval) {}
-
-    return ret;
+    return last;
 }
 
-// This is the only hardcoded variable which defines the max size of a message
-// to be the same as the max size of the message in the starter code of the sender.
-// static const int MAX_BUFFER_LEN = 128 * 8;
-
-void benchmark_receive(struct config *config_p) {
-    FILE *receiverSave = fopen("data/receiverSave", "w+");
-    if (receiverSave == NULL) {
-        fprintf(stderr, "ERROR: cannot open file to save.\n"
-                "Check if data/ folder is created\n");
-        exit(-1);
-    }
-
-    uint32_t benchmarkSize = 8192;
-    uint8_t *msg = (uint8_t *)malloc(sizeof(uint8_t) * benchmarkSize);
-    uint64_t start_t;
-    struct timespec beg_t, end_t;
-    for (uint32_t i = 0; i < benchmarkSize; i++) {
-        // sync every 1024 bits, detecting pilot signal again
-        if ((i & 0x3ff) == 0) {
-            bool curr = true, prev = true;
-            int flip_sequence = 4;
-            while (true) {
-                start_t = cc_sync();
-                curr = detect_bit(config_p);
-
-                if (flip_sequence == 0 && curr == 1 && prev == 1) {
-                    debug("pilot signal detected for round %u\r", i / 1024);
-                    start_t = cc_sync();
-                    if (i == 0) clock_gettime(CLOCK_MONOTONIC, &beg_t);
-                    break;
-                }
-                else if (flip_sequence > 0 && curr != prev) {
-                    flip_sequence--;
-                }
-                else if (curr == prev) {
-                    flip_sequence = 4;
-                }
-                prev = curr;
+/*
+ * Receives the frames of a transfer with selective-repeat ARQ, in rounds of
+ * a window of frame slots each followed by an ACK frame sent back over the
+ * reverse regions, see arq.h. Payloads go to sink in order. Returns whether
+ * the last frame was received; the reception goes on for a few rounds after
+ * it in case the sender missed the final ACK, and ends early once the sender
+ * is silent for ARQ_MAX_SILENT_ROUNDS.
+ */
+bool receive_file_arq(const struct config *config, struct symbol_clock *clk,
+                      uint8_t *soft, uint32_t *frames,
+                      void (*sink)(void *, const uint8_t *, size_t), void *sink_arg) {
+    struct arq_receiver *arq = malloc(sizeof(*arq));
+    struct bitstream wire;
+    bs_init(&wire);
+    struct frame frame, ack;
+    uint32_t silent = 0;
+
+    arq_receiver_init(arq);
+    while (silent < (arq->done? ARQ_LINGER_ROUNDS: ARQ_MAX_SILENT_ROUNDS)) {
+        bool heard = false;
+        for (uint32_t i = 0; i < config->arq_window; i++) {
+            int ret = receive_frame(config, clk, soft, &frame);
+            if (ret == 1 && !(frame.flags & FRAME_FLAG_ACK)) {
+                arq_receiver_frame(arq, &frame, sink, sink_arg);
             }
+            heard |= ret >= 0;
         }
+        silent = heard? 0: silent + 1;
 
-        msg[i] = detect_bit(config_p);
-
+        // acknowledge on the nominal slots, the sender has its own gate
+        clk->slot += ARQ_TURNAROUND_SLOTS * config->interval;
+        arq_receiver_ack(arq, &ack);
+        clk->slot = send_frame(&ack, &wire, clk->slot, config->reverse);
+        clk->slot += ARQ_TURNAROUND_SLOTS * config->interval;
     }
 
-    clock_gettime(CLOCK_MONOTONIC, &end_t);
-    printf("total cycles to receive %u bits is %lu\n", benchmarkSize,
-    (end_t.tv_sec - beg_t.tv_sec) * (long)1e9 + (end_t.tv_nsec -
-    beg_t.tv_nsec));
+    if (arq->duplicates) {
+        printf("%u frames received twice\n", arq->duplicates);
+    }
+    *frames = arq->delivered;
+    bool last = arq->done;
+    bs_free(&wire);
+    free(arq);
+    return last;
+}
 
-    if (msg) {
-        for (uint32_t i = 0; i < benchmarkSize; i++) {
-            fprintf(receiverSave, "%u %u\n", i, msg[i]);
-        }
-        fclose(receiverSave);
+void sink_bitstream(void *bs, const uint8_t *data, size_t len) {
+    bs_push_bytes(bs, data, len);
+}
 
-        free(msg);
-    }
+void sink_transfer(void *out, const uint8_t *data, size_t len) {
+    transfer_write(out, data, len);
 }
 
 int main(int argc, char **argv)
@@ -250,106 +216,77 @@ int main(int argc, char **argv)
     struct config config;
 
     init_config(&config, argc, argv);
-    if (config.channel == PrimeProbe || config.channel == L1DPrimeProbe) {
-        detect_bit = detect_bit_pp;
-    }
-    else if (config.channel == FlushReload) {
-        detect_bit = detect_bit_fr;
-    }
 
-    char msg_ch[MAX_BUFFER_LEN + 1];
-    int flip_sequence = 4;
-    bool current;
-    bool previous = true;
+    struct bitstream msg_bits;
+    bs_init(&msg_bits);
+    uint8_t *soft = malloc(frame_wire_bits(config.fec));
+    struct symbol_clock clk;
 
     if (config.benchmark_mode) {
         benchmark_receive(&config);
         exit(0);
     }
 
-    printf("Press enter to begin listening ");
-    getchar();
+    struct transfer out;
+    if (config.out_filename) {
+        transfer_open_output(&out, config.out_filename);
+    } else {
+        printf("Press enter to begin listening ");
+        getchar();
+    }
+    clock_init(&clk, &config);
+    if (config.probe_cpu >= 0) {
+        clk.ring = pipeline_start(&config, config.probe_cpu);
+    }
     while (1) {
 
-        // cc_sync on clock edge
-        uint64_t start_t = cc_sync();
-        // current = detect_bit(&config, start_t);
-        current = detect_bit(&config);
-
-        // This receiving loop is a sort of finite config machine.
-        // Once again, it would be easier to explain how it works
-        // in a whiteboard, but here is an attempt to give an idea:
-        //
-        // Starting from the base config, it first looks for a sequence
-        // of bits of the form "1010" (ref: flip_sequence variable).
-        //
-        // The first 1 is used to cc_synchronize, the following ones are
-        // used to make sure that the cc_synchronization was right.
-        //
-        // Once these bits have been detected, if there are other bit
-        // flips, the receiver ignores them.
-        //
-        // In fact, as of now the sender sends more than 4 bit flips.
-        // This is because sometimes the receiver may miss the first 2.
-        // Thus having more still works.
-        //
-        // After the 1010 bits, when two consecutive 11 bits are detected,
-        // the receiver will know that what follows is a message and go
-        // into message receiving mode.
-        //
-        // Finally, when a NULL byte is received the receiver exits the
-        // message receiving mode and restarts from the base config.
-        if (flip_sequence == 0 && current == 1 && previous == 1) {
-            debug("Start sequence fully detected.\n\n");
-
-            uint32_t msg_len = 0, strike_zeros = 0;
-            start_t = cc_sync();
-            for (msg_len = 0; msg_len < MAX_BUFFER_LEN; msg_len++) {
-#if 1
-                // uint32_t bit = detect_bit(&config, start_t);
-                uint32_t bit = detect_bit(&config);
-                msg_ch[msg_len] = '0' + bit;
-                strike_zeros = (strike_zeros + (1-bit)) & (bit-1);
-                if (strike_zeros >= 8 && ((msg_len & 0x7) == 0)) {
-                    debug("String finished\n");
-                    break;
-                }
-
-#else
-                if (detect_bit(&config)) {
-                    msg_ch[msg_len] = '1';
-                    strike_zeros = 0;
-                } else {
-                    msg_ch[msg_len] = '0';
-                    if (++strike_zeros >= 8 && msg_len % 8 == 0) {
-                        debug("String finished\n");
-                        break;
-                    }
-                }
-#endif
-                start_t += config.interval;
+        // The message comes in frames on the slots after the preamble (and
+        // the training sequence of multi-level channels), each starting with
+        // the resync word and protected by a CRC. Corrupted frames are
+        // dropped, and the receiver goes back to waiting for a preamble
+        // after the last frame of the message, or when no resync word shows
+        // up for a few frames.
+        clock_catch_up(&clk, &config);
+        wait_preamble(&config, &clk);
+        debug("Start sequence fully detected.\n\n");
+        train_levels(&config, &clk);
+
+        uint32_t frames;
+        if (config.out_filename) {
+            transfer_start(&out);
+            bool last = config.arq?
+                receive_file_arq(&config, &clk, soft, &frames, sink_transfer, &out):
+                receive_message(&config, &clk, soft, &frames, sink_transfer, &out);
+            if (!last) {
+                printf("transfer incomplete\n");
             }
+            transfer_close(&out);
+            transfer_report(&out, "received", frames);
+            break;
+        }
 
-            msg_ch[msg_len - 8] = '\0';
-            printf("message %s received\n", msg_ch);
-
-            uint32_t ascii_msg_len = msg_len / 8;
-            char msg[ascii_msg_len];
-            printf("> %s\n", conv_msg(msg_ch, ascii_msg_len, msg));
-            if (strcmp(msg, "exit") == 0) {
-                break;
-            }
-
-        } else if (flip_sequence > 0 && current != previous) {
-            flip_sequence--;
-
-        } else if (current == previous) {
-            flip_sequence = 4;
+        bs_clear(&msg_bits);
+        bool last = receive_message(&config, &clk, soft, &frames, sink_bitstream, &msg_bits);
+        if (!last) {
+            debug("String incomplete\n");
         }
 
-        previous = current;
+        size_t msg_len = msg_bits.nbits / 8;
+        char *msg = malloc(msg_len + 1);
+        msg[bs_to_bytes(&msg_bits, 0, (uint8_t *) msg, msg_len)] = '\0';
+        printf("> %s\n", msg);
+        bool stop = last && strcmp(msg, "exit") == 0;
+        free(msg);
+        if (stop) {
+            break;
+        }
     }
 
+    if (clk.ring) {
+        pipeline_stop(clk.ring);
+    }
+    bs_free(&msg_bits);
+    free(soft);
     printf("Receiver finished\n");
     return 0;
 }
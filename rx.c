@@ -0,0 +1,682 @@
+#include "util.h"
+
+/*
+ * Builds the probing sets of the regions of the channel (or maps the shared
+ * file) and selects the detector. pid marks the pages in use.
+ */
+void rx_init(struct config *config, uint64_t pid) {
+    if (config->channel == PrimeProbe || config->channel == L1DPrimeProbe) {
+        bool discover = config->channel == PrimeProbe && config->discover_evsets;
+        // Restrict the probing set to the L1 ways to aviod self eviction,
+        // while for the LLC more lines than private cache ways helps to put
+        // more lines into llc slices, increasing chance of to conflict with sender
+        uint32_t set_limit = config->channel == L1DPrimeProbe?
+                             geometry.l1_ways: 5 * (geometry.l1_ways + geometry.l2_ways);
+        // discovery needs enough candidates to cover every slice
+        if (discover) {
+            set_limit = EVSET_POOL_LINES;
+        }
+
+        // The lines with the set index of a region are a slice apart, so
+        // the buffer only needs to span set_limit slices
+        uint64_t bsize = (uint64_t) set_limit * geometry.l3_slice_sets * CACHE_LINESIZE;
+        config->buffer = allocate_buffer(bsize);
+        printf("buffer pointer addr %p\n", config->buffer);
+
+        // Construct one addr_set per region from the first set_limit lines
+        // with the cache set index of that region, or collect them as
+        // candidates for discovery. Only these lines are made non-zero, so
+        // only the pages that hold them are backed.
+        uint32_t addr_set_size[MAX_CHANNEL_WIDTH] = {0};
+        ADDR_PTR *candidates[MAX_CHANNEL_WIDTH] = {NULL};
+        for (uint32_t k = 0; k < config->width; k++) {
+            if (discover) {
+                candidates[k] = malloc(set_limit * sizeof(ADDR_PTR));
+            }
+            for (uint32_t n = 0; n < set_limit; n++) {
+                ADDR_PTR addr = slice_set_line(config->buffer, config->cache_regions[k], n);
+                *(char *) addr = pid;
+                if (discover) {
+                    candidates[k][n] = addr;
+                } else {
+                    evset_append(&config->addr_sets[k], addr);
+                }
+            }
+            addr_set_size[k] = set_limit;
+        }
+
+        for (uint32_t k = 0; k < config->width; k++) {
+            // monitoring a single slice is enough, the sender covers them all
+            if (discover) {
+                find_evset(config, "receiver", k, bsize, 1, candidates[k], addr_set_size[k]);
+                addr_set_size[k] = config->addr_sets[k].size;
+                free(candidates[k]);
+                if (addr_set_size[k] == 0) {
+                    fprintf(stderr, "ERROR: no eviction set found for region %lu!\n",
+                            config->cache_regions[k]);
+                    exit(-1);
+                }
+            }
+            evset_shuffle(&config->addr_sets[k], config->evset_seed);
+            printf("Found addr_set size of %u for region %lu\n",
+                   addr_set_size[k], config->cache_regions[k]);
+        }
+    }
+
+    if (shared_memory_channel(config->channel)) {
+        map_shared_file(config);
+    }
+
+    // Until trained, multi-level channels assume misses grow evenly with
+    // levels, two levels keep their decision at half the L1 ways missing
+    for (uint32_t k = 0; k < config->width; k++) {
+        for (uint32_t l = 0; l < config->levels; l++) {
+            config->level_means[k][l] = config->levels == 2? l * (geometry.l1_ways - 1.0):
+                    (double) l * config->addr_sets[k].size / (config->levels - 1);
+        }
+        config->level_sigma[k] = (config->level_means[k][1] - config->level_means[k][0]) / 4;
+    }
+
+    if (config->channel == PrimeProbe || config->channel == L1DPrimeProbe) {
+        detect_symbol = detect_symbol_pp;
+    }
+    else if (config->channel == FlushReload) {
+        detect_symbol = detect_symbol_fr;
+    }
+    else if (config->channel == FlushFlush) {
+        detect_symbol = detect_symbol_ff;
+    }
+}
+
+/*
+ * Picks the level whose mean is nearest to x and stores the log-likelihood
+ * ratio of each of its bits in llr, assuming Gaussian noise of deviation
+ * sigma around the level means (max-log approximation). Returns the level.
+ * The level is read from the signs of the ratios, so that x halfway between
+ * two means gives the same zero bit as its soft value.
+ */
+uint32_t soft_level(double x, const double *means, double sigma, uint32_t levels, float *llr) {
+    double ll[MAX_CHANNEL_LEVELS];
+    for (uint32_t l = 0; l < levels; l++) {
+        ll[l] = -(x - means[l]) * (x - means[l]) / (2 * sigma * sigma);
+    }
+
+    uint64_t bits = 0;
+    for (uint32_t b = 0; (1U << b) < levels; b++) {
+        double one = -HUGE_VAL, zero = -HUGE_VAL;
+        for (uint32_t l = 0; l < levels; l++) {
+            if ((level_to_bits(l) >> b) & 1) {
+                one = ll[l] > one? ll[l]: one;
+            } else {
+                zero = ll[l] > zero? ll[l]: zero;
+            }
+        }
+        llr[b] = one - zero;
+        bits |= (uint64_t) (llr[b] > 0) << b;
+    }
+    return bits_to_level(bits);
+}
+
+// receiver function pointer, detects the symbol of the slot starting at
+// start_t, region k carries bits k * level_bits and up
+void (*detect_symbol)(const struct config*, uint64_t, struct symbol_sample*);
+
+void clock_init(struct symbol_clock *clk, const struct config *config) {
+    clk->slot = next_slot(config);
+    clk->phase = 0;
+    clk->early = 0;
+    clk->late = 0;
+    clk->count = 0;
+    clk->ring = NULL;
+}
+
+/*
+ * Moves the clock to the next slot ahead if the current one already began,
+ * e.g. after printing a message. Only for when no symbols are expected.
+ */
+void clock_catch_up(struct symbol_clock *clk, const struct config *config) {
+    // the probe thread never stops, its samples are all still to come
+    if (clk->ring)
+        return;
+    if (clk->slot + clk->phase < get_time()) {
+        clk->slot = next_slot(config);
+    }
+}
+
+/*
+ * Returns when to start sampling the current slot.
+ */
+uint64_t clock_start(const struct symbol_clock *clk, const struct config *config) {
+    int64_t dither = config->interval / CHANNEL_CLOCK_DITHER_FRACTION;
+    return clk->slot + clk->phase + (clk->count & 1? dither: -dither);
+}
+
+/*
+ * Moves on to the next slot, feeding the early-late gate with sample
+ * unless NULL.
+ */
+void clock_tick(struct symbol_clock *clk, const struct symbol_sample *sample,
+                const struct config *config) {
+    clk->slot += config->interval;
+    if (sample == NULL)
+        return;
+
+    double strength = 0;
+    for (uint32_t b = 0; b < symbol_bits(config); b++) {
+        strength += fabs(sample->llr[b]);
+    }
+    if (clk->count & 1) {
+        clk->late += strength;
+    } else {
+        clk->early += strength;
+    }
+
+    if (++clk->count % CHANNEL_CLOCK_GATE_SYMBOLS == 0) {
+        int64_t step = config->interval / CHANNEL_CLOCK_DITHER_FRACTION / 2;
+        int64_t bound = config->interval / 4;
+        double error = (clk->late - clk->early) / (clk->late + clk->early + 1e-9);
+        if (error > CHANNEL_CLOCK_DEADBAND && clk->phase + step < bound) {
+            clk->phase += step;
+        } else if (error < -CHANNEL_CLOCK_DEADBAND && clk->phase - step > -bound) {
+            clk->phase -= step;
+        }
+        debug("clock phase %ld (early-late error %.3f)\n", clk->phase, error);
+        clk->early = 0;
+        clk->late = 0;
+    }
+}
+
+/*
+ * Detects the symbol of the current slot, or takes it from the probe thread,
+ * and moves the clock on. The probe thread decides P+P levels with the
+ * means the receiver started with, they are decided again with the trained
+ * ones here.
+ */
+static void next_symbol(const struct config *config, struct symbol_clock *clk,
+                        struct symbol_sample *sample) {
+    if (!clk->ring) {
+        detect_symbol(config, clock_start(clk, config), sample);
+        clock_tick(clk, sample, config);
+        return;
+    }
+    bool probed = pipeline_sample(clk->ring, clk->slot, sample);
+    clk->slot += config->interval;
+    if (probed && !shared_memory_channel(config->channel)) {
+        soft_symbol(config, sample);
+    }
+}
+
+/*
+ * Detects the symbol of the current slot and moves the clock on. With
+ * Manchester coding the complement in the following slot is detected as
+ * well, and the soft values of both are combined.
+ */
+void receive_symbol(const struct config *config, struct symbol_clock *clk,
+                    struct symbol_sample *sample) {
+    next_symbol(config, clk, sample);
+    if (!config->manchester)
+        return;
+
+    struct symbol_sample second;
+    next_symbol(config, clk, &second);
+
+    // the complement flips the top bit of each region's level
+    uint64_t flip = level_symbol(config->levels - 1, config);
+    sample->symbol = 0;
+    for (uint32_t b = 0; b < symbol_bits(config); b++) {
+        sample->llr[b] += (flip >> b) & 1? -second.llr[b]: second.llr[b];
+        sample->symbol |= (uint64_t) (sample->llr[b] > 0) << b;
+    }
+}
+
+/*
+ * Detects a bit sent over every region of the channel by majority vote,
+ * a region reading a one when its level is in the upper half.
+ */
+bool detect_bit(const struct config *config, struct symbol_clock *clk) {
+    struct symbol_sample sample;
+    next_symbol(config, clk, &sample);
+    uint32_t ones = 0;
+    for (uint32_t k = 0; k < config->width; k++) {
+        ones += (sample.symbol >> ((k + 1) * config->level_bits - 1)) & 1;
+    }
+    return ones * 2 > config->width;
+}
+
+/*
+ * Fills the latency statistics of a region from its valid measurements.
+ */
+void region_stats(struct region_sample *region, uint64_t latency_sum, uint32_t min_latency) {
+    region->mean_latency = region->samples? latency_sum / region->samples: 0;
+    region->min_latency = region->samples? min_latency: 0;
+}
+
+/*
+ * Detects a symbol by reloading (F+R) or flushing (F+F) the line of every
+ * region, in the shuffled line order, once per access period of the slot
+ * starting at start_t. A region reads a one when most of its measurements
+ * were over the threshold: reloads missing since the sender flushed the
+ * line, or flushes slowed down by the sender having cached it.
+ */
+static inline __attribute__((always_inline))
+void detect_symbol_lines(const struct config *config, uint64_t start_t,
+                         struct symbol_sample *sample, bool reload) {
+    int misses[MAX_CHANNEL_WIDTH] = {0};
+    int total_measurements[MAX_CHANNEL_WIDTH] = {0};
+    uint64_t latency_sum[MAX_CHANNEL_WIDTH] = {0};
+    uint32_t min_latency[MAX_CHANNEL_WIDTH];
+    int outliers = 0;
+    for (uint32_t k = 0; k < config->width; k++) {
+        min_latency[k] = UINT32_MAX;
+    }
+
+    // This is high because the misses caused by clflush
+    // usually cause an access time larger than 150 cycles
+
+    struct telemetry_record *record = telemetry_next();
+    uint64_t now = rdtsc();
+    while (rdtsc() < start_t) {}
+    while ((rdtsc() - start_t) < config->interval) {
+        for (uint32_t i = 0; i < config->width; i++) {
+            uint32_t k = config->line_order[i];
+            ADDR_PTR addr = config->addr_sets[k].head;
+            uint64_t time = reload? measure_one_block_access_time(addr): measure_flush_time(addr);
+            telemetry_latency(k, time);
+
+            // When the access time is larger than the outlier threshold,
+            // it is usually due to a disk miss. We exclude such misses
+            // because they are not caused by clflush.
+            if (time >= config->outlier_threshold) {
+                outliers++;
+                continue;
+            }
+            total_measurements[k]++;
+            latency_sum[k] += time;
+            min_latency[k] = time < min_latency[k]? time: min_latency[k];
+            misses[k] += time > config->miss_threshold;
+        }
+
+        // Busy loop to give time to the sender to flush the cache
+        uint64_t wait_t = rdtsc();
+        while((rdtsc() - wait_t) < config->access_period &&
+                   (rdtsc() - start_t) < config->interval);
+    }
+
+    if (record) {
+        uint64_t end = rdtsc();
+        uint32_t samples = 0;
+        for (uint32_t k = 0; k < config->width; k++) {
+            samples += total_measurements[k];
+        }
+        *record = (struct telemetry_record) {
+            .start_t = start_t,
+            .late = now > start_t? now - start_t: 0,
+            .probe = end - start_t,
+            .overrun = end > start_t + config->interval? end - start_t - config->interval: 0,
+            .samples = samples,
+            .outliers = outliers,
+        };
+    }
+
+    // a one is a majority of misses, the soft value is the miss fraction
+    static const double fraction_means[2] = { 0, 1 };
+    sample->symbol = 0;
+    for (uint32_t k = 0; k < config->width; k++) {
+        if (misses[k] != 0) {
+            debug("Region %u misses: %d out of %d\n", k, misses[k], total_measurements[k]);
+        }
+        struct region_sample *region = &sample->regions[k];
+        region->misses = misses[k];
+        region->samples = total_measurements[k];
+        region_stats(region, latency_sum[k], min_latency[k]);
+
+        double fraction = total_measurements[k]? (double) misses[k] / total_measurements[k]: 0.5;
+        sample->symbol |= (uint64_t) soft_level(fraction, fraction_means, CHANNEL_FR_MISS_SIGMA,
+                                                2, sample->llr + k) << k;
+    }
+}
+
+void detect_symbol_fr(const struct config *config, uint64_t start_t, struct symbol_sample *sample) {
+    detect_symbol_lines(config, start_t, sample, true);
+}
+
+// F+F never brings the line back, so the sender's accesses are what cache it
+void detect_symbol_ff(const struct config *config, uint64_t start_t, struct symbol_sample *sample) {
+    detect_symbol_lines(config, start_t, sample, false);
+}
+
+/*
+ * Times a pointer chase through all the lines of a set with a single pair of
+ * timestamps, from the head forward or from the tail backward. Each load
+ * depends on the previous one, so the chase needs no fences of its own.
+ */
+static inline __attribute__((always_inline))
+uint64_t chase_set(const struct evset *set, bool backward)
+{
+    ADDR_PTR addr = backward? set->tail: set->head;
+#ifdef SIMULATOR
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < set->size; i++) {
+        addr = backward? evset_prev(addr): evset_next(addr);
+    }
+    return rdtsc() - start;
+#else
+    uint32_t lo, hi;
+    asm volatile("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi) :: "rcx", "memory");
+    uint64_t start = (uint64_t) hi << 32 | lo;
+    for (uint32_t i = 0; i < set->size; i++) {
+        addr = backward? evset_prev(addr): evset_next(addr);
+    }
+    asm volatile("rdtscp" : "=a"(lo), "=d"(hi) :: "rcx", "memory");
+    return ((uint64_t) hi << 32 | lo) - start;
+#endif
+}
+
+/*
+ * Converts the chase time of the set of region k into a miss count, from
+ * how much it exceeds the chase of the idle set. The idle time tracks the
+ * fastest chase, drifting up slowly in case the timing changes.
+ */
+static uint32_t chase_misses(const struct config *config, uint32_t k, uint64_t time)
+{
+    static double idle[MAX_CHANNEL_WIDTH];
+    if (idle[k] == 0 || time < idle[k]) {
+        idle[k] = time;
+    } else {
+        idle[k] += (time - idle[k]) / CHANNEL_PROBE_BASELINE_DECAY;
+    }
+
+    double misses = round((time - idle[k]) / config->miss_penalty);
+    return misses < config->addr_sets[k].size? misses: config->addr_sets[k].size;
+}
+
+/*
+ * Primes the probing set of every region at start_t, waits for the sender
+ * and counts the misses per region when probing.
+ *
+ * Prime and probe are interleaved across the sets, so a wide channel
+ * carries all its bits within the same interval.
+ */
+void probe_regions_pp(const struct config *config, uint64_t start_t,
+                      struct region_sample *regions)
+{
+    struct telemetry_record *record = telemetry_next();
+    uint64_t now = get_time();
+    while (get_time() < start_t) {}
+    // debug("time %lx\n", start_t);
+
+    int misses[MAX_CHANNEL_WIDTH] = {0};
+    int hits[MAX_CHANNEL_WIDTH] = {0};
+    int total_measurements[MAX_CHANNEL_WIDTH] = {0};
+    uint64_t latency_sum[MAX_CHANNEL_WIDTH] = {0};
+    uint32_t min_latency[MAX_CHANNEL_WIDTH];
+
+    // miss in L3
+    ADDR_PTR current[MAX_CHANNEL_WIDTH];
+    uint32_t max_size = 0;
+    for (uint32_t k = 0; k < config->width; k++) {
+        min_latency[k] = UINT32_MAX;
+        current[k] = config->addr_sets[k].head;
+        if (config->addr_sets[k].size > max_size)
+            max_size = config->addr_sets[k].size;
+    }
+
+    // prime, the sets are rings so every walk ends back at the head
+    uint64_t prime_count = 0;
+    do {
+        for (uint32_t i = 0; i < max_size; i++) {
+            for (uint32_t k = 0; k < config->width; k++) {
+                if (i >= config->addr_sets[k].size)
+                    continue;
+                current[k] = evset_next(current[k]);
+                prime_count++;
+            }
+        }
+    } while ((get_time() - start_t) < config->prime_period);
+    uint64_t primed_t = get_time();
+
+    // wait for sender to access
+    while (get_time() - start_t < (config->prime_period + config->access_period)) {}
+
+    // probe
+    uint64_t probe_t = get_time();
+    uint32_t probes = 0;
+    if (config->probe_kernel == ProbeSerial) {
+        // Multi-level sets are probed from the last line primed backward:
+        // in priming order, the first miss evicts the next line to probe and
+        // any partial eviction cascades through the whole set
+        bool backward = config->levels > 2;
+        for (uint32_t k = 0; backward && k < config->width; k++) {
+            current[k] = config->addr_sets[k].tail;
+        }
+        for (uint32_t i = 0; i < max_size && (get_time() - start_t) < config->interval; i++) {
+            for (uint32_t k = 0; k < config->width; k++) {
+                if (i >= config->addr_sets[k].size)
+                    continue;
+                ADDR_PTR addr = current[k];
+                uint64_t time = measure_one_block_access_time(addr);
+                telemetry_latency(k, time);
+                probes++;
+
+                // When the access time is larger than the outlier threshold,
+                // it is usually due to a long-latency page walk.
+                // We exclude such misses
+                // because they are not caused by accesses from the sender.
+                bool valid = time < config->outlier_threshold;
+                total_measurements[k] += valid;
+                misses[k]  += valid && (time > config->miss_threshold);
+                hits[k]    += valid && (time <= config->miss_threshold);
+                latency_sum[k] += valid? time: 0;
+                if (valid && time < min_latency[k])
+                    min_latency[k] = time;
+
+                current[k] = backward? evset_prev(addr): evset_next(addr);
+                // debug("access time %lu\n", time);
+            }
+        }
+    } else {
+        // one timing per set, zig-zag walks back from the last line primed
+        for (uint32_t k = 0; k < config->width; k++) {
+            const struct evset *set = &config->addr_sets[k];
+            uint64_t time = config->probe_kernel == ProbeZigzag?
+                            chase_set(set, true): chase_set(set, false);
+            telemetry_latency(k, time / set->size);
+            probes += set->size;
+
+            misses[k] = chase_misses(config, k, time);
+            total_measurements[k] = set->size;
+            latency_sum[k] = time;
+            min_latency[k] = time / set->size;
+        }
+    }
+
+    if (record) {
+        uint64_t end = get_time();
+        uint32_t samples = 0;
+        for (uint32_t k = 0; k < config->width; k++) {
+            samples += total_measurements[k];
+        }
+        *record = (struct telemetry_record) {
+            .start_t = start_t,
+            .late = now > start_t? now - start_t: 0,
+            .prime = primed_t - start_t,
+            .access = probe_t - primed_t,
+            .probe = end - probe_t,
+            .overrun = end > start_t + config->interval? end - start_t - config->interval: 0,
+            .ops = prime_count,
+            .samples = samples,
+            .outliers = probes - samples,
+        };
+    }
+
+    for (uint32_t k = 0; k < config->width; k++) {
+        if (misses[k] != 0) {
+            debug("Region %u misses: %d out of %d\n", k, misses[k], total_measurements[k]);
+        }
+        regions[k].misses = misses[k];
+        regions[k].samples = total_measurements[k];
+        region_stats(&regions[k], latency_sum[k], min_latency[k]);
+    }
+}
+
+/*
+ * Detects a symbol by measuring the access time of the addresses in the
+ * probing set of every region and counting the number of misses per region
+ * within the clock length of config->interval.
+ */
+// bool detect_bit(const struct config *config, uint64_t start_t)
+void detect_symbol_pp(const struct config *config, uint64_t start_t, struct symbol_sample *sample)
+{
+    probe_regions_pp(config, start_t, sample->regions);
+    soft_symbol(config, sample);
+}
+
+/*
+ * Decides the level of every region from its miss count, the one with the
+ * nearest mean.
+ */
+void soft_symbol(const struct config *config, struct symbol_sample *sample)
+{
+    sample->symbol = 0;
+    for (uint32_t k = 0; k < config->width; k++) {
+        // FIXME: If only one set region used in a L1D, the channel is really not
+        // reliable as too much noise even from stack reads and writes.
+        // Mulitple regions for each channel is recommended.
+        // The hardcoded 1 miss count threshold can be used for a noisy l1d-PP
+        // (level means of 0 and 2 for two levels)
+        uint32_t level = soft_level(sample->regions[k].misses, config->level_means[k],
+                                    config->level_sigma[k], config->levels,
+                                    sample->llr + k * config->level_bits);
+        sample->symbol |= level_to_bits(level) << (k * config->level_bits);
+    }
+}
+
+/*
+ * Detects on every slot of the shared schedule from the one of clk, and
+ * returns once the preamble has been received, on the slot after it.
+ */
+void wait_preamble(const struct config *config, struct symbol_clock *clk)
+{
+    int flip_sequence = 4;
+    bool current;
+    bool previous = true;
+    while (true) {
+        current = detect_bit(config, clk);
+
+        // This receiving loop is a sort of finite config machine.
+        // Once again, it would be easier to explain how it works
+        // in a whiteboard, but here is an attempt to give an idea:
+        //
+        // Starting from the base config, it first looks for a sequence
+        // of bits of the form "1010" (ref: flip_sequence variable).
+        //
+        // The first 1 is used to find the sender on the slot schedule, the
+        // following ones are used to make sure that it really was the sender.
+        //
+        // Once these bits have been detected, if there are other bit
+        // flips, the receiver ignores them.
+        //
+        // In fact, as of now the sender sends more than 4 bit flips.
+        // This is because sometimes the receiver may miss the first 2.
+        // Thus having more still works.
+        //
+        // After the 1010 bits, when two consecutive 11 bits are detected,
+        // the receiver will know that what follows is a message and go
+        // into message receiving mode.
+        if (flip_sequence == 0 && current == 1 && previous == 1) {
+            return;
+
+        } else if (flip_sequence > 0 && current != previous) {
+            flip_sequence--;
+
+        } else if (current == previous) {
+            flip_sequence = 4;
+        }
+
+        previous = current;
+    }
+}
+
+/*
+ * Learns the level means and noise deviation of a multi-level channel from
+ * the training sequence following the preamble, which repeats every level
+ * in turn.
+ */
+void train_levels(struct config *config, struct symbol_clock *clk) {
+    if (config->levels <= 2)
+        return;
+
+    struct symbol_sample sample;
+    struct region_sample *regions = sample.regions;
+    double sums[MAX_CHANNEL_WIDTH][MAX_CHANNEL_LEVELS] = {{0}};
+    double squares[MAX_CHANNEL_WIDTH] = {0};
+    for (int i = 0; i < CHANNEL_TRAINING_REPEATS; i++) {
+        for (uint32_t level = 0; level < config->levels; level++) {
+            if (clk->ring) {
+                next_symbol(config, clk, &sample);
+            } else {
+                probe_regions_pp(config, clock_start(clk, config), regions);
+                clock_tick(clk, NULL, config);
+            }
+            for (uint32_t k = 0; k < config->width; k++) {
+                sums[k][level] += regions[k].misses;
+                squares[k] += (double) regions[k].misses * regions[k].misses;
+            }
+        }
+    }
+
+    for (uint32_t k = 0; k < config->width; k++) {
+        // pooled variance around the level means
+        double variance = squares[k];
+        for (uint32_t l = 0; l < config->levels; l++) {
+            double mean = sums[k][l] / CHANNEL_TRAINING_REPEATS;
+            // keep the means ordered even if the training was noisy
+            if (l > 0 && mean < config->level_means[k][l - 1])
+                mean = config->level_means[k][l - 1];
+            config->level_means[k][l] = mean;
+            variance -= sums[k][l] * sums[k][l] / CHANNEL_TRAINING_REPEATS;
+            debug("Region %u level %u: %.1f misses\n", k, l, mean);
+        }
+        variance /= config->levels * (CHANNEL_TRAINING_REPEATS - 1);
+        config->level_sigma[k] = sqrt(variance) > 0.5? sqrt(variance): 0.5;
+    }
+}
+
+/*
+ * Returns the next hard bit, and its soft value in soft unless NULL.
+ */
+bool read_bit(struct symbol_reader *reader, const struct config *config, uint8_t *soft) {
+    if (reader->bits == 0) {
+        receive_symbol(config, reader->clk, &reader->sample);
+        reader->bits = symbol_bits(config);
+    }
+    uint32_t b = symbol_bits(config) - reader->bits--;
+    if (soft) {
+        *soft = fec_soft_from_llr(reader->sample.llr[b]);
+    }
+    return (reader->sample.symbol >> b) & 1;
+}
+
+/*
+ * Receives the frame on the slots of clk. The whole frame is always read
+ * so that the clock stays on the frame boundaries.
+ * Returns 1 if the frame passed its CRC, 0 if it is corrupted and has to be
+ * dropped, and -1 if it does not start with the resync word.
+ */
+int receive_frame(const struct config *config, struct symbol_clock *clk,
+                  uint8_t *soft, struct frame *frame) {
+    struct symbol_reader reader = { .clk = clk, .bits = 0 };
+    size_t body_bits = frame_wire_bits(config->fec) - FRAME_SYNC_BITS;
+
+    uint32_t sync = 0;
+    for (int i = 0; i < FRAME_SYNC_BITS; i++) {
+        sync = (sync << 1) | read_bit(&reader, config, NULL);
+    }
+    for (size_t i = 0; i < body_bits; i++) {
+        read_bit(&reader, config, &soft[i]);
+    }
+
+    if (__builtin_popcount(sync ^ FRAME_SYNC_WORD) > FRAME_SYNC_TOLERANCE)
+        return -1;
+    return frame_decode(soft, config->fec, frame);
+}
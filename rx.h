@@ -0,0 +1,65 @@
+#ifndef RX_H_
+#define RX_H_
+
+// Included from util.h after struct config, which provides the standard headers.
+
+/*
+ * Receiving end of the channel: probing sets, symbol detection on the slot
+ * schedule and frame reception. Linked into the receiver, and into the
+ * sender for the reverse channel of ARQ transfers.
+ */
+
+/*
+ * Receiver side of the slot schedule. Slots sit on multiples of the interval
+ * of the shared TSC, shifted by a phase that an early-late gate tunes:
+ * symbols are sampled a little early and late in turn, and the phase moves
+ * towards the side whose soft values come out stronger.
+ */
+struct symbol_clock {
+    uint64_t slot;          // start of the current slot on the shared grid
+    int64_t phase;
+    double early, late;     // |LLR| summed over early and late samples
+    uint32_t count;
+    struct sample_ring *ring;   // samples of the probe thread, NULL to probe inline
+};
+
+/*
+ * Hands out the bits of the detected symbols one at a time.
+ */
+struct symbol_reader {
+    struct symbol_clock *clk;
+    struct symbol_sample sample;
+    uint32_t bits;
+};
+
+// receiver function pointer, detects the symbol of the slot starting at
+// start_t, region k carries bits k * level_bits and up
+extern void (*detect_symbol)(const struct config*, uint64_t, struct symbol_sample*);
+
+void rx_init(struct config *config, uint64_t pid);
+uint32_t soft_level(double x, const double *means, double sigma, uint32_t levels, float *llr);
+
+void clock_init(struct symbol_clock *clk, const struct config *config);
+void clock_catch_up(struct symbol_clock *clk, const struct config *config);
+uint64_t clock_start(const struct symbol_clock *clk, const struct config *config);
+void clock_tick(struct symbol_clock *clk, const struct symbol_sample *sample,
+                const struct config *config);
+
+void receive_symbol(const struct config *config, struct symbol_clock *clk,
+                    struct symbol_sample *sample);
+bool detect_bit(const struct config *config, struct symbol_clock *clk);
+void region_stats(struct region_sample *region, uint64_t latency_sum, uint32_t min_latency);
+void detect_symbol_fr(const struct config *config, uint64_t start_t, struct symbol_sample *sample);
+void detect_symbol_ff(const struct config *config, uint64_t start_t, struct symbol_sample *sample);
+void probe_regions_pp(const struct config *config, uint64_t start_t,
+                      struct region_sample *regions);
+void soft_symbol(const struct config *config, struct symbol_sample *sample);
+void detect_symbol_pp(const struct config *config, uint64_t start_t, struct symbol_sample *sample);
+void wait_preamble(const struct config *config, struct symbol_clock *clk);
+void train_levels(struct config *config, struct symbol_clock *clk);
+
+bool read_bit(struct symbol_reader *reader, const struct config *config, uint8_t *soft);
+int receive_frame(const struct config *config, struct symbol_clock *clk,
+                  uint8_t *soft, struct frame *frame);
+
+#endif
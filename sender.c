@@ -9,204 +9,164 @@ void init_config(struct config *config, int argc, char **argv) {
 
     init_default(config, argc, argv);
 
-    if (config->channel == PrimeProbe) {
-        int L3_way_stride = ipow(2, LOG_CACHE_SETS_L3 + LOG_CACHE_LINESIZE);
-        uint64_t bsize = 8 * CACHE_WAYS_L3 * L3_way_stride;
-
-        // Allocate a buffer of the size of the LLC
-        // config->buffer = malloc((size_t) bsize);
-        config->buffer = allocate_buffer(bsize);
-        printf("buffer pointer addr %p\n", config->buffer);
-
-        // Initialize the buffer to be be the non-zero page
-        for (uint32_t i = 0; i < bsize; i += 64) {
-            *(config->buffer + i) = pid;
-        }
-
-        // Construct the addr_set by taking the addresses that have cache set index 0
-        uint32_t addr_set_size = 0;
-        for (int set_index = 0; set_index < CACHE_SETS_L3; set_index++) {
-            for (uint32_t line_index = 0; line_index < 8 * CACHE_WAYS_L3; line_index++) {
-                // a simple hash to shuffle the lines in physical address space
-                uint32_t stride_idx = (line_index * 167 + 13) % (8 * CACHE_WAYS_L3);
-                ADDR_PTR addr = (ADDR_PTR) (config->buffer + \
-                        set_index * CACHE_LINESIZE + stride_idx * L3_way_stride);
-                // both of following function should work...L3 is a more restrict set
-                if (get_cache_slice_set_index(addr) == config->cache_region) {
-                // if (get_L3_cache_set_index(addr) == config->cache_region) {
-                    append_string_to_linked_list(&config->addr_set, addr);
-                    addr_set_size++;
-                }
-            }
-        }
-        printf("Found addr_set size of %u\n", addr_set_size);
+    tx_init(config, pid);
+    if (config->reverse) {
+        rx_init(config->reverse, pid);
     }
 
-    if (config->channel == L1DPrimeProbe) {
-        int L1_way_stride = ipow(2, LOG_CACHE_SETS_L1 + LOG_CACHE_LINESIZE); // 4096
-        uint64_t bsize = 256 * CACHE_WAYS_L1 * L1_way_stride; // 64 * 8 * 4k = 2M
-
-        // Allocate a buffer twice the size of the L1 cache
-        config->buffer = allocate_buffer(bsize);
-
-        printf("buffer pointer addr %p\n", config->buffer);
-        // Initialize the buffer to be be the non-zero page
-        for (uint32_t i = 0; i < bsize; i += 64) {
-            *(config->buffer + i) = pid;
-        }
-        // Construct the addr_set by taking the addresses that have cache set index 0
-        // There will be at least one of such addresses in our buffer.
-        uint32_t addr_set_size = 0;
-        for (int i = 0; i < 256 * CACHE_WAYS_L1 * CACHE_SETS_L1; i++) {
-            ADDR_PTR addr = (ADDR_PTR) (config->buffer + CACHE_LINESIZE * i);
-            // both of following function should work...L3 is a more restrict set
-            if (get_cache_slice_set_index(addr) == config->cache_region) {
-            // if (get_L3_cache_set_index(addr) == config->cache_region) {
-                append_string_to_linked_list(&config->addr_set, addr);
-                addr_set_size++;
-            }
-            // restrict the probing set to CACHE_WAYS_L1 to aviod self eviction
-            if (addr_set_size >= 2 * (CACHE_WAYS_L1 + CACHE_WAYS_L2)) break;
-        }
-
-        printf("Found addr_set size of %u\n", addr_set_size);
-
+    // keep what this run measured for the next one
+    if (config->profile_path && config->profile.dirty) {
+        profile_save(config->profile_path, &config->profile);
     }
-
-    if (config->channel == FlushReload) {
-        int inFile = open(config->shared_filename, O_RDONLY);
-        if (inFile == -1) {
-            fprintf(stderr, "ERROR: Failed to Open File\n");
-            exit(-1);
-        }
-
-        size_t size = 4096;
-        config->buffer = mmap(NULL, size, PROT_READ, MAP_SHARED, inFile, 0);
-        if (config->buffer == (void*) -1 ) {
-            fprintf(stderr, "ERROR: Failed to Map Address\n");
-            exit(-1);
-        }
-
-        ADDR_PTR addr = (ADDR_PTR) config->buffer + config->cache_region * 64;
-        append_string_to_linked_list(&config->addr_set, addr);
-        printf("File mapped at %p and monitoring line %lx\n", config->buffer, addr);
-    }
-
 }
 
-// sender function pointer
-void (*send_bit)(bool, const struct config*);
-
-void send_bit_fr(bool one, const struct config *config) {
-    uint64_t start_t = rdtsc();
-
-    if (one) {
-        ADDR_PTR addr = config->addr_set->addr;
-        while ((rdtsc() - start_t) < config->interval) {
-            clflush(addr);
-        }
-
-    } else {
-        start_t = rdtsc();
-        while (rdtsc() - start_t < config->interval) {}
-    }
-}
 /*
- * Sends a bit to the receiver by repeatedly flushing the addresses of the addr_set
- * for the clock length of config->interval when we are sending a one, or by doing nothing
- * for the clock length of config->interval when we are sending a zero.
+ * Sends the preamble followed by the message split into frames, back to
+ * back on the slot schedule. Slots sit on multiples of the interval of the
+ * TSC shared with the receiver, so long messages do not drift out of sync.
+ * Returns the number of frames sent.
  */
-void send_bit_pp(bool one, const struct config *config)
-{
-    uint64_t start_t = get_time();
-    debug("time %lx\n", start_t);
-
-    if (one) {
-        // wait for receiver to prime the cache set
-        while (get_time() - start_t < config->prime_period) {}
-
-        // access
-        uint64_t access_count = 0;
-        struct Node *current = NULL;
-        uint64_t stopTime = start_t + config->prime_period + config->access_period;
-        // uint64_t stopTime = start_t + config->interval;
-        do {
-            current = config->addr_set;
-            while (current != NULL && current->next != NULL && get_time() < stopTime) {
-            // while (current != NULL && get_time() < stopTime) {
-                volatile uint64_t* addr1 = (uint64_t*) current->addr;
-                volatile uint64_t* addr2 = (uint64_t*) current->next->addr;
-                *addr1;
-                *addr2;
-                *addr1;
-                *addr2;
-                *addr1;
-                *addr2;
-                current = current->next;
-                access_count++;
-            }
-        } while (get_time() < stopTime);
-        debug("access count %lu time %lx\n", access_count, get_time() - start_t);
+uint32_t send_message(const uint8_t *data, size_t len, const struct config *config) {
+    struct bitstream wire;
+    bs_init(&wire);
+    uint32_t frames = 0;
+    size_t offset = 0;
+
+    uint64_t start_t = send_preamble(next_slot(config), config);
+    do {
+        struct frame frame = { .seq = frames++ };
+        frame.len = len - offset < FRAME_PAYLOAD_BYTES? len - offset: FRAME_PAYLOAD_BYTES;
+        memcpy(frame.payload, data + offset, frame.len);
+        offset += frame.len;
+        frame.flags = offset == len? FRAME_FLAG_LAST: 0;
+        start_t = send_frame(&frame, &wire, start_t, config);
+    } while (offset < len);
+
+    bs_free(&wire);
+    return frames;
+}
 
-        // wait for receiver to probe
-        while (get_time() - start_t < config->interval) {}
+/*
+ * Sends the whole input as one message. The next frame is read ahead
+ * so that the last one can be flagged. Returns the number of frames sent.
+ */
+uint32_t send_file(struct transfer *in, const struct config *config) {
+    struct bitstream wire;
+    bs_init(&wire);
+    uint32_t frames = 0;
+    struct frame next = { 0 };
+    next.len = transfer_read(in, next.payload, FRAME_PAYLOAD_BYTES);
+
+    transfer_start(in);
+    uint64_t start_t = send_preamble(next_slot(config), config);
+    do {
+        struct frame frame = next;
+        frame.seq = frames++;
+        next.len = transfer_read(in, next.payload, FRAME_PAYLOAD_BYTES);
+        frame.flags = next.len == 0? FRAME_FLAG_LAST: 0;
+        start_t = send_frame(&frame, &wire, start_t, config);
+    } while (next.len > 0);
+
+    bs_free(&wire);
+    return frames;
+}
 
-    } else {
-        while (get_time() - start_t < config->interval) {}
+/*
+ * Sends the whole input with selective-repeat ARQ: after the preamble, rounds
+ * of up to a window of frames, each followed by the ACK of the receiver on
+ * the reverse regions, until every frame is acknowledged. Frame slots left
+ * over in a round stay idle so that both sides keep the same round length.
+ * Returns the number of frames sent, retransmissions included.
+ */
+uint32_t send_file_arq(struct transfer *in, const struct config *config) {
+    const struct config *reverse = config->reverse;
+    struct arq_sender *arq = malloc(sizeof(*arq));
+    const struct frame *frames[ARQ_MAX_WINDOW];
+    uint8_t *soft = malloc(frame_wire_bits(reverse->fec));
+    struct bitstream wire;
+    bs_init(&wire);
+    struct frame ack;
+    struct symbol_clock clk;
+    uint32_t silent = 0;
+
+    arq_sender_init(arq, config->arq_window, in);
+    transfer_start(in);
+    clock_init(&clk, reverse);
+    uint64_t start_t = send_preamble(next_slot(config), config);
+    while (!arq_sender_done(arq) && silent < ARQ_MAX_SILENT_ROUNDS) {
+        uint32_t n = arq_sender_round(arq, in, frames);
+        for (uint32_t i = 0; i < n; i++) {
+            start_t = send_frame(frames[i], &wire, start_t, config);
+        }
+        start_t += (uint64_t) ((config->arq_window - n) * frame_slots(config) +
+                               ARQ_TURNAROUND_SLOTS) * config->interval;
+
+        // the ACK follows on the same schedule, the early-late gate of the
+        // reverse clock carries over from round to round
+        clk.slot = start_t;
+        if (receive_frame(reverse, &clk, soft, &ack) == 1 && (ack.flags & FRAME_FLAG_ACK)) {
+            arq_sender_ack(arq, &ack);
+            silent = 0;
+        } else {
+            silent++;
+        }
+        start_t = clk.slot + ARQ_TURNAROUND_SLOTS * config->interval;
     }
-}
 
-uint8_t *generate_random_msg(uint32_t size) {
-    uint8_t *msg = (uint8_t *)malloc(sizeof(uint8_t) * size);
-    srand(time(NULL));
-    for(uint32_t i = 0; i < size; i++) {
-        int randomnum = rand();
-        msg[i] = (randomnum > RAND_MAX/2);
+    if (!arq_sender_done(arq)) {
+        printf("transfer incomplete, no acknowledgement for %d rounds\n", ARQ_MAX_SILENT_ROUNDS);
     }
-    return msg;
+    printf("%u frames sent, %u of them resent\n", arq->sent + arq->resent, arq->resent);
+    uint32_t frames_sent = arq->sent + arq->resent;
+    bs_free(&wire);
+    free(soft);
+    free(arq);
+    return frames_sent;
 }
 
 void benchmark_send(struct config *config_p) {
-    FILE *senderSave = fopen("data/senderSave", "w+");
-    if (!senderSave) {
+    // ccbench workers share their bits in memory, others save them to data/
+    struct bench_shm *shm = NULL;
+    FILE *senderSave = NULL;
+    if (config_p->bench_shm_name) {
+        shm = bench_shm_open(config_p->bench_shm_name, false);
+    } else if (!(senderSave = fopen("data/senderSave", "w+"))) {
         fprintf(stderr, "ERROR: cannot open file to save.\n"
                 "Check if data/ folder is created\n");
         exit(-1);
     }
 
-    uint32_t benchmarkSize = 8192;
-    uint8_t *randomMsg = generate_random_msg(benchmarkSize);
-    uint64_t start_t;
-
-    for (uint32_t i = 0; i < benchmarkSize; i++) {
-        // sync every 1024 bits
-        if ((i & 0x3ff) == 0) {
-            for (int j = 0; j < 10; j++) {
-                start_t = cc_sync();
-                send_bit(j % 2 == 0, config_p);
-            }
-
-            start_t = cc_sync();
-            send_bit(true, config_p);
-
-            start_t = cc_sync();
-            send_bit(true, config_p);
-
-            // Send the message bit by bit
-            debug("pilot signal sentt for round %u\r", i / 1024);
-            start_t = cc_sync();
+    // The benchmark carries symbol_bits(config) bits per interval,
+    // the random payload is coded into those raw bits
+    uint32_t benchmarkSize = bench_run_bits(shm, symbol_bits(config_p));
+    struct bitstream payload, randomMsg;
+    bs_init(&payload);
+    bs_init(&randomMsg);
+    benchmark_payload(config_p, benchmarkSize, &payload, &randomMsg);
+    if (shm) {
+        memcpy(shm->sent, randomMsg.words, (benchmarkSize + 63) / 64 * 8);
+        while (!shm->receiver_ready) {
+            usleep(1000);
         }
-        send_bit(randomMsg[i], config_p);
     }
 
-    if (randomMsg) {
+    // sync once, then the whole message follows on the slot schedule
+    uint64_t start_t = send_preamble(next_slot(config_p), config_p);
+    debug("pilot signal sent\n");
+    send_bits(&randomMsg, start_t, config_p);
+
+    if (shm) {
+        shm->sender_done = 1;
+        bench_shm_close(shm);
+    } else {
         for (uint32_t i = 0; i < benchmarkSize; i++) {
-            fprintf(senderSave, "%u %u\n", i, randomMsg[i]);
+            fprintf(senderSave, "%u %u\n", i, bs_get(&randomMsg, i));
         }
         fclose(senderSave);
-
-        free(randomMsg);
     }
+
+    bs_free(&payload);
+    bs_free(&randomMsg);
 }
 
 int main(int argc, char **argv)
@@ -214,96 +174,48 @@ int main(int argc, char **argv)
     // Initialize config and local variables
     struct config config;
     init_config(&config, argc, argv);
-    if (config.channel == PrimeProbe || config.channel == L1DPrimeProbe) {
-        send_bit = send_bit_pp;
-    }
-    else if (config.channel == FlushReload) {
-        send_bit = send_bit_fr;
-    }
 
     if (config.benchmark_mode) {
         benchmark_send(&config);
         exit(0);
     }
 
-    uint64_t start_t, end_t;
+    if (config.in_filename) {
+        struct transfer in;
+        transfer_open_input(&in, config.in_filename);
+        uint32_t frames = config.arq? send_file_arq(&in, &config): send_file(&in, &config);
+        transfer_close(&in);
+        transfer_report(&in, "sent", frames);
+        exit(0);
+    }
+
     int sending = 1;
     printf("Please type a message (exit to stop).\n");
 
-#if 0
-    char all_one_msg[129];
-    for (uint32_t i = 0; i < 120; i++)
-        all_one_msg[i] = '1';
-    for (uint32_t i = 120; i < 128; i++)
-        all_one_msg[i] = '1';
-    all_one_msg[128] = '\0';
-#endif
+    char *text_buf = NULL;
+    size_t text_cap = 0;
 
     while (sending) {
-#if 0
-        char *msg = all_one_msg;
-#else
-        // Get a message to send from the user
+        // Get a message to send from the user, of any length
         printf("< ");
-        char text_buf[128];
-        fgets(text_buf, sizeof(text_buf), stdin);
-
-        if (strcmp(text_buf, "exit\n") == 0) {
-            sending = 0;
+        ssize_t text_len = getline(&text_buf, &text_cap, stdin);
+        if (text_len < 0) {
+            text_buf = realloc(text_buf, sizeof("exit"));
+            strcpy(text_buf, "exit");
         }
 
-        char *msg = string_to_binary(text_buf);
-#endif
-
-        // If we are in benchmark mode, start measuring the time
-        if (config.benchmark_mode) {
-            start_t = get_time();
-        }
-
-        // Send a '10101011' byte to let the receiver detect that
-        // I am about to send a start string and cc_sync
-        size_t msg_len = strlen(msg);
-
-        // cc_sync on clock edge
-        uint64_t start_t =  cc_sync();
-
-        for (int i = 0; i < 10; i++) {
-            start_t = cc_sync();
-            // send_bit(i % 2 == 0, &config, start_t);
-            send_bit(i % 2 == 0, &config);
-        }
-        start_t = cc_sync();
-        // send_bit(true, &config, start_t);
-        send_bit(true, &config);
-        start_t = cc_sync();
-        // send_bit(true, &config, start_t);
-        send_bit(true, &config);
-
-        // Send the message bit by bit
-        start_t = cc_sync();
-        // TODO: for longer messages it is recommended to re-sync every X bits
-        for (uint32_t ind = 0; ind < msg_len; ind++) {
-            if (msg[ind] == '0') {
-                // send_bit(false, &config, start_t);
-                send_bit(false, &config);
-            } else {
-                // send_bit(true, &config, start_t);
-                send_bit(true, &config);
-            }
-            start_t += config.interval;
+        // the trailing newline is not part of the message
+        text_len = strcspn(text_buf, "\n");
+        text_buf[text_len] = '\0';
+        if (strcmp(text_buf, "exit") == 0) {
+            sending = 0;
         }
 
-        printf("message %s sent\n", msg);
-
-        // If we are in benchmark mode, finish measuring the
-        // time and print the bit rate.
-        // if (config.benchmark_mode) {
-        //     end_t = get_time();
-        //     printf("Bitrate: %.2f Bytes/second\n",
-        //            ((double) strlen(text_buf)) / ((double) (end_t - start_t) / CLOCKS_PER_SEC));
-        // }
+        uint32_t frames = send_message((uint8_t *) text_buf, text_len, &config);
+        printf("message of %zd bytes sent in %u frames\n", text_len, frames);
     }
 
+    free(text_buf);
     printf("Sender finished\n");
     return 0;
 }
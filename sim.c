@@ -0,0 +1,533 @@
+#include "util.h"
+#include <sched.h>
+#include <stdatomic.h>
+
+#define SIM_FOREIGN_LINE        (1ULL << 62)    // lines of the noise, never the channel's
+#define SIM_PHYS_BASE           (1ULL << 48)    // above any user virtual address
+#define SIM_PHYS_ALIGN          (1ULL << 30)
+
+struct sim_mapping {
+    ADDR_PTR virt;
+    uint64_t len;
+    uint64_t phys;
+    const char *name;                   // NULL for anonymous memory
+};
+
+static struct {
+    struct sim_params params;
+    struct sim_cache llc;
+    uint64_t *noise_t;                  // when noise was last let into each LLC set
+    uint64_t foreign;
+    uint64_t noise_rng;
+    struct sim_cache l1[SIM_AGENTS];
+    struct sim_agent agents[SIM_AGENTS];
+    struct sim_mapping mappings[SIM_MAX_MAPPINGS];
+    uint32_t nmappings;
+    uint64_t next_phys;
+
+    _Atomic int turn;                   // agent allowed to run
+    uint64_t barrier;                   // end of the current quantum
+} sim;
+
+static __thread struct sim_agent *current;
+
+static uint64_t next_random(uint64_t *state)
+{
+    // splitmix64
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static double uniform(uint64_t *state)
+{
+    return (next_random(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static double gaussian(uint64_t *state)
+{
+    double u = uniform(state) + 1e-300, v = uniform(state);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/*
+ * Draws from a Poisson distribution, stopping at max.
+ */
+static uint32_t poisson(uint64_t *state, double mean, uint32_t max)
+{
+    double limit = exp(-mean), p = uniform(state);
+    uint32_t k = 0;
+    while (p > limit && k < max) {
+        p *= uniform(state);
+        k++;
+    }
+    return k;
+}
+
+static void cache_alloc(struct sim_cache *cache, uint32_t sets, uint32_t ways)
+{
+    cache->sets = sets;
+    cache->ways = ways;
+    cache->tags = calloc((uint64_t) sets * ways, sizeof(uint64_t));
+    cache->ages = calloc((uint64_t) sets * ways, sizeof(uint32_t));
+    cache->tree = calloc(sets, sizeof(uint64_t));
+    if (!cache->tags || !cache->ages || !cache->tree) {
+        fprintf(stderr, "ERROR: cannot allocate the simulated caches\n");
+        exit(-1);
+    }
+}
+
+static void cache_clear(struct sim_cache *cache)
+{
+    memset(cache->tags, 0, (uint64_t) cache->sets * cache->ways * sizeof(uint64_t));
+    memset(cache->ages, 0, (uint64_t) cache->sets * cache->ways * sizeof(uint32_t));
+    memset(cache->tree, 0, cache->sets * sizeof(uint64_t));
+    cache->stamp = 0;
+}
+
+/*
+ * Tree-PLRU over any number of ways: every node splits its ways in two
+ * halves and points to the one to evict from next. A node is numbered by
+ * the first way of its right half, which no other node shares.
+ */
+static uint32_t plru_victim(uint64_t tree, uint32_t ways)
+{
+    uint32_t first = 0, count = ways;
+    while (count > 1) {
+        uint32_t split = first + count / 2;
+        if ((tree >> split) & 1) {
+            count -= split - first;
+            first = split;
+        } else {
+            count = split - first;
+        }
+    }
+    return first;
+}
+
+static uint64_t plru_touch(uint64_t tree, uint32_t ways, uint32_t way)
+{
+    uint32_t first = 0, count = ways;
+    while (count > 1) {
+        uint32_t split = first + count / 2;
+        // point away from the way just used
+        if (way >= split) {
+            tree &= ~(1ULL << split);
+            count -= split - first;
+            first = split;
+        } else {
+            tree |= 1ULL << split;
+            count = split - first;
+        }
+    }
+    return tree;
+}
+
+static void cache_touch(struct sim_cache *cache, uint32_t set, uint32_t way)
+{
+    uint32_t *ages = cache->ages + (uint64_t) set * cache->ways;
+    switch (sim.params.policy) {
+        case ReplaceLRU:
+            ages[way] = ++cache->stamp;
+            break;
+        case ReplacePLRU:
+            cache->tree[set] = plru_touch(cache->tree[set], cache->ways, way);
+            break;
+        case ReplaceQLRU:
+            ages[way] = 0;
+            break;
+    }
+}
+
+/*
+ * Returns the way to fill in set: an invalid one if any, otherwise the
+ * one the replacement policy picks.
+ */
+static uint32_t cache_victim(struct sim_cache *cache, uint32_t set)
+{
+    uint64_t *tags = cache->tags + (uint64_t) set * cache->ways;
+    uint32_t *ages = cache->ages + (uint64_t) set * cache->ways;
+    for (uint32_t way = 0; way < cache->ways; way++) {
+        if (tags[way] == 0)
+            return way;
+    }
+
+    uint32_t victim = 0;
+    switch (sim.params.policy) {
+        case ReplaceLRU:
+            for (uint32_t way = 1; way < cache->ways; way++) {
+                if (ages[way] < ages[victim])
+                    victim = way;
+            }
+            break;
+        case ReplacePLRU:
+            victim = plru_victim(cache->tree[set], cache->ways);
+            break;
+        case ReplaceQLRU: {
+            // age every line until one reaches 3, the first of those goes
+            uint32_t oldest = 0;
+            for (uint32_t way = 0; way < cache->ways; way++) {
+                oldest = ages[way] > oldest? ages[way]: oldest;
+            }
+            for (uint32_t way = 0; way < cache->ways; way++) {
+                ages[way] += 3 - oldest;
+            }
+            while (ages[victim] != 3) {
+                victim++;
+            }
+            break;
+        }
+    }
+    return victim;
+}
+
+static int cache_find(const struct sim_cache *cache, uint32_t set, uint64_t line)
+{
+    const uint64_t *tags = cache->tags + (uint64_t) set * cache->ways;
+    for (uint32_t way = 0; way < cache->ways; way++) {
+        if (tags[way] == line)
+            return way;
+    }
+    return -1;
+}
+
+static void cache_fill(struct sim_cache *cache, uint32_t set, uint32_t way, uint64_t line)
+{
+    cache->tags[(uint64_t) set * cache->ways + way] = line;
+    cache_touch(cache, set, way);
+    if (sim.params.policy == ReplaceQLRU) {
+        cache->ages[(uint64_t) set * cache->ways + way] = 1;
+    }
+}
+
+/*
+ * Removes line from an L1, returns whether it was there.
+ */
+static bool l1_drop(struct sim_cache *cache, uint64_t line)
+{
+    uint32_t set = line & (cache->sets - 1);
+    int way = cache_find(cache, set, line);
+    if (way < 0)
+        return false;
+    cache->tags[(uint64_t) set * cache->ways + way] = 0;
+    return true;
+}
+
+static uint32_t llc_set(uint64_t line)
+{
+    // slice hash over the bits above the set index within a slice
+    uint64_t upper = line / geometry.l3_slice_sets;
+    uint32_t slice = ((upper * 0x9e3779b97f4a7c15) >> 32) % geometry.l3_slices;
+    return slice * geometry.l3_slice_sets + (line & (geometry.l3_slice_sets - 1));
+}
+
+/*
+ * Fills line into the LLC, evicting a line of the set from every L1 as the
+ * LLC is inclusive.
+ */
+static void llc_fill(uint32_t set, uint64_t line)
+{
+    uint32_t way = cache_victim(&sim.llc, set);
+    uint64_t victim = sim.llc.tags[(uint64_t) set * sim.llc.ways + way];
+    if (victim) {
+        for (int a = 0; a < SIM_AGENTS; a++) {
+            l1_drop(&sim.l1[a], victim);
+        }
+    }
+    cache_fill(&sim.llc, set, way, line);
+}
+
+/*
+ * Lets in the lines other programs filled into set since it was last used,
+ * a Poisson number of them for the time passed.
+ */
+static void llc_noise(uint32_t set, uint64_t now)
+{
+    if (sim.params.noise_rate <= 0 || now <= sim.noise_t[set])
+        return;
+    double mean = sim.params.noise_rate * (now - sim.noise_t[set]) / 1e6;
+    sim.noise_t[set] = now;
+    // more fills than ways only replace the foreign lines
+    uint32_t fills = poisson(&sim.noise_rng, mean, sim.llc.ways);
+    for (uint32_t i = 0; i < fills; i++) {
+        llc_fill(set, SIM_FOREIGN_LINE | sim.foreign++);
+    }
+}
+
+/*
+ * Returns the simulated physical line of addr. Addresses outside of the
+ * mappings stand for themselves.
+ */
+static uint64_t phys_line(ADDR_PTR addr)
+{
+    for (int i = sim.nmappings - 1; i >= 0; i--) {
+        const struct sim_mapping *map = &sim.mappings[i];
+        if (addr - map->virt < map->len)
+            return (map->phys + addr - map->virt) / CACHE_LINESIZE;
+    }
+    return addr / CACHE_LINESIZE;
+}
+
+static struct sim_agent *agent()
+{
+    return current? current: &sim.agents[SIM_SETUP];
+}
+
+/*
+ * Waits until it is the turn of agent a, polling for a while before
+ * yielding the core.
+ */
+static void wait_turn(struct sim_agent *a)
+{
+    int id = a - sim.agents;
+    for (uint32_t i = 0; atomic_load_explicit(&sim.turn, memory_order_acquire) != id; i++) {
+        if (i >= SIM_SPIN_ROUNDS)
+            sched_yield();
+    }
+}
+
+/*
+ * Hands over at the end of the quantum of agent a: the sender to the
+ * receiver, which then opens the next quantum for the sender. An agent
+ * runs on alone once the other one is done.
+ */
+static void hand_over(struct sim_agent *a)
+{
+    int id = a - sim.agents, other = id == SIM_SENDER? SIM_RECEIVER: SIM_SENDER;
+    if (id == SIM_RECEIVER || sim.agents[other].done) {
+        sim.barrier += sim.params.quantum;
+    }
+    if (!sim.agents[other].done) {
+        atomic_store_explicit(&sim.turn, other, memory_order_release);
+        wait_turn(a);
+    }
+}
+
+/*
+ * Moves the clock of the running agent on by cycles, with the interrupts
+ * that fall in between.
+ */
+static void advance(uint64_t cycles)
+{
+    struct sim_agent *a = agent();
+    a->now += cycles;
+    while (a->now >= a->next_irq) {
+        a->now += SIM_IRQ_CYCLES;
+        a->next_irq += -log(1 - uniform(&a->rng)) * 1e6 / sim.params.irq_rate;
+    }
+    if (a == &sim.agents[SIM_SETUP])
+        return;
+    if (a->deadline && a->now > a->deadline) {
+        a->expired = true;
+        longjmp(a->escape, 1);
+    }
+    while (a->now >= sim.barrier) {
+        hand_over(a);
+    }
+}
+
+/*
+ * Loads line through the hierarchy, returns its latency.
+ */
+static uint64_t access_line(uint64_t line)
+{
+    struct sim_agent *a = agent();
+    struct sim_cache *l1 = a->l1;
+    uint32_t l1_set = line & (l1->sets - 1);
+    int way = cache_find(l1, l1_set, line);
+    if (way >= 0) {
+        cache_touch(l1, l1_set, way);
+        return SIM_L1_CYCLES;
+    }
+
+    uint32_t set = llc_set(line);
+    if (a != &sim.agents[SIM_SETUP]) {
+        llc_noise(set, a->now);
+    }
+    uint64_t latency = SIM_LLC_CYCLES;
+    way = cache_find(&sim.llc, set, line);
+    if (way >= 0) {
+        cache_touch(&sim.llc, set, way);
+    } else {
+        llc_fill(set, line);
+        latency = SIM_DRAM_CYCLES;
+    }
+    cache_fill(l1, l1_set, cache_victim(l1, l1_set), line);
+    return latency;
+}
+
+/*
+ * Allocates the caches of the global geometry.
+ */
+void sim_init(const struct sim_params *params)
+{
+    sim.params = *params;
+    if (geometry.l3_ways > 64 || geometry.l1_ways > 64) {
+        fprintf(stderr, "ERROR: the simulator supports at most 64 ways\n");
+        exit(-1);
+    }
+    uint32_t llc_sets = geometry.l3_slices * geometry.l3_slice_sets;
+    cache_alloc(&sim.llc, llc_sets, geometry.l3_ways);
+    sim.noise_t = calloc(llc_sets, sizeof(uint64_t));
+    for (int a = 0; a < SIM_AGENTS; a++) {
+        cache_alloc(&sim.l1[a], geometry.l1_sets, geometry.l1_ways);
+    }
+    sim.next_phys = SIM_PHYS_BASE;
+    sim_reset(0, false);
+}
+
+/*
+ * Empties the caches and restarts every agent at time 0, with random
+ * streams derived from seed. With shared_l1, sender and receiver run on
+ * one core, as the L1D channel needs.
+ */
+void sim_reset(uint64_t seed, bool shared_l1)
+{
+    cache_clear(&sim.llc);
+    memset(sim.noise_t, 0, sim.llc.sets * sizeof(uint64_t));
+    sim.foreign = 0;
+    sim.noise_rng = seed;
+    for (int a = 0; a < SIM_AGENTS; a++) {
+        struct sim_agent *agent = &sim.agents[a];
+        cache_clear(&sim.l1[a]);
+        agent->now = 0;
+        agent->deadline = 0;
+        agent->rng = seed * SIM_AGENTS + a;
+        agent->l1 = &sim.l1[a == SIM_RECEIVER && shared_l1? SIM_SENDER: a];
+        agent->done = false;
+        agent->expired = false;
+        agent->next_irq = sim.params.irq_rate > 0 && a != SIM_SETUP?
+                          -log(1 - uniform(&agent->rng)) * 1e6 / sim.params.irq_rate: UINT64_MAX;
+    }
+    sim.barrier = sim.params.quantum;
+    atomic_store(&sim.turn, SIM_SENDER);
+}
+
+/*
+ * Registers memory the channel mapped at addr. Mappings of the same name
+ * share their simulated physical memory, anonymous ones (NULL) get their
+ * own, aligned like a huge page.
+ */
+void sim_map(const void *addr, uint64_t len, const char *name)
+{
+    if (sim.nmappings == SIM_MAX_MAPPINGS) {
+        fprintf(stderr, "ERROR: more than %d simulated mappings\n", SIM_MAX_MAPPINGS);
+        exit(-1);
+    }
+    struct sim_mapping *map = &sim.mappings[sim.nmappings++];
+    *map = (struct sim_mapping) { .virt = (ADDR_PTR) addr, .len = len, .name = name };
+    for (uint32_t i = 0; name && i < sim.nmappings - 1; i++) {
+        if (sim.mappings[i].name && strcmp(sim.mappings[i].name, name) == 0) {
+            map->phys = sim.mappings[i].phys;
+            return;
+        }
+    }
+    map->phys = sim.next_phys;
+    sim.next_phys += (len + SIM_PHYS_ALIGN - 1) / SIM_PHYS_ALIGN * SIM_PHYS_ALIGN;
+}
+
+struct sim_thread {
+    struct sim_agent *agent;
+    void *(*body)(void *);
+    void *arg;
+};
+
+static void *sim_thread(void *arg)
+{
+    struct sim_thread *thread = arg;
+    struct sim_agent *a = thread->agent;
+    current = a;
+    wait_turn(a);
+    if (setjmp(a->escape) == 0) {
+        thread->body(thread->arg);
+    }
+
+    int other = a == &sim.agents[SIM_SENDER]? SIM_RECEIVER: SIM_SENDER;
+    a->done = true;
+    atomic_store_explicit(&sim.turn, other, memory_order_release);
+    return NULL;
+}
+
+/*
+ * Runs sender(arg) and receiver(arg) on their agents until both return or
+ * pass deadline (virtual cycles, 0 for none). Call sim_reset first.
+ */
+void sim_run(void *(*sender)(void *), void *(*receiver)(void *), void *arg, uint64_t deadline)
+{
+    struct sim_thread threads[2] = {
+        { &sim.agents[SIM_SENDER], sender, arg },
+        { &sim.agents[SIM_RECEIVER], receiver, arg },
+    };
+    pthread_t ids[2];
+    for (int i = 0; i < 2; i++) {
+        threads[i].agent->deadline = deadline;
+        int err = pthread_create(&ids[i], NULL, sim_thread, &threads[i]);
+        if (err) {
+            fprintf(stderr, "ERROR: cannot start a simulated agent: %s\n", strerror(err));
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(ids[i], NULL);
+    }
+}
+
+/*
+ * Whether agent was stopped at the deadline of the last run.
+ */
+bool sim_expired(int agent)
+{
+    return sim.agents[agent].expired;
+}
+
+uint64_t sim_time()
+{
+    advance(SIM_RDTSC_CYCLES);
+    return agent()->now;
+}
+
+void sim_load(ADDR_PTR addr)
+{
+    advance(access_line(phys_line(addr)));
+}
+
+/*
+ * Returns the measured latency of a load, interrupts included.
+ */
+uint64_t sim_measure(ADDR_PTR addr)
+{
+    struct sim_agent *a = agent();
+    uint64_t start = a->now;
+    double latency = SIM_MEASURE_CYCLES + access_line(phys_line(addr));
+    if (sim.params.jitter > 0) {
+        latency += sim.params.jitter * gaussian(&a->rng);
+    }
+    advance(latency > 1? latency: 1);
+    return a->now - start;
+}
+
+/*
+ * Flushes the line of addr from every cache, returns the time it took.
+ */
+uint64_t sim_flush(ADDR_PTR addr)
+{
+    struct sim_agent *a = agent();
+    uint64_t line = phys_line(addr), start = a->now;
+    bool cached = false;
+    for (int i = 0; i < SIM_AGENTS; i++) {
+        cached |= l1_drop(&sim.l1[i], line);
+    }
+    uint32_t set = llc_set(line);
+    int way = cache_find(&sim.llc, set, line);
+    if (way >= 0) {
+        sim.llc.tags[(uint64_t) set * sim.llc.ways + way] = 0;
+        cached = true;
+    }
+    double latency = cached? SIM_FLUSH_CACHED_CYCLES: SIM_FLUSH_CYCLES;
+    if (sim.params.jitter > 0) {
+        latency += sim.params.jitter * gaussian(&a->rng);
+    }
+    advance(latency > 1? latency: 1);
+    return a->now - start;
+}
@@ -0,0 +1,86 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+// Included from util.h, which provides ADDR_PTR and the standard headers.
+#include <setjmp.h>
+
+/*
+ * Software model of the cache hierarchy, which the primitives of util.c
+ * (timed loads, flushes, the TSC) run on in the builds with -DSIMULATOR.
+ * Each agent (the sender, the receiver, and the main thread while setting
+ * up) has a private L1D and a virtual clock; they share an inclusive LLC of
+ * the global geometry, split in slices by a hash of the address. Memory the
+ * channel maps is translated to simulated physical addresses, a mapping of
+ * the same file landing at the same place in every agent. Foreign fills and
+ * interrupts only hit the runs, the channel is set up on a quiet model.
+ *
+ * Sender and receiver run as threads in lockstep virtual time: time is cut
+ * into quanta, and in each quantum the sender runs first and the receiver
+ * second, handing over at the end. Only one agent runs at a time, so a run
+ * only depends on its seed.
+ */
+#define SIM_TSC_HZ              3e9     // virtual cycles per second
+#define SIM_RDTSC_CYCLES        25      // a fenced TSC read
+#define SIM_MEASURE_CYCLES      35      // overhead of a timed load
+#define SIM_L1_CYCLES           5
+#define SIM_LLC_CYCLES          75
+#define SIM_DRAM_CYCLES         265
+#define SIM_FLUSH_CYCLES        100     // clflush of an uncached line
+#define SIM_FLUSH_CACHED_CYCLES 200
+#define SIM_IRQ_CYCLES          20000   // time an interrupt takes from the agent
+#define SIM_DEFAULT_QUANTUM     2000
+#define SIM_MAX_MAPPINGS        64
+#define SIM_SPIN_ROUNDS         1000    // polls of the turn before yielding the core
+
+typedef enum _replacement {
+    ReplaceLRU = 0,
+    ReplacePLRU,                        // tree pseudo-LRU
+    ReplaceQLRU                         // 2-bit ages, inserting at age 1
+} Replacement;
+
+enum {
+    SIM_SENDER = 0,
+    SIM_RECEIVER,
+    SIM_SETUP,                          // the main thread, outside of runs
+    SIM_AGENTS
+};
+
+struct sim_params {
+    Replacement policy;
+    uint64_t quantum;                   // cycles an agent runs before handing over
+    double noise_rate;                  // foreign fills per LLC set and million cycles
+    double jitter;                      // deviation of timed loads, in cycles
+    double irq_rate;                    // interrupts per agent and million cycles
+};
+
+struct sim_cache {
+    uint32_t sets, ways;
+    uint64_t *tags;                     // line addresses, 0 when invalid
+    uint32_t *ages;                     // LRU stamps, or QLRU ages
+    uint64_t *tree;                     // tree-PLRU bits, one word per set
+    uint32_t stamp;
+};
+
+struct sim_agent {
+    uint64_t now;                       // virtual TSC
+    uint64_t next_irq;
+    uint64_t deadline;                  // the agent is stopped past it, 0 for none
+    uint64_t rng;
+    struct sim_cache *l1;
+    bool done;
+    bool expired;                       // stopped at the deadline
+    jmp_buf escape;
+};
+
+void sim_init(const struct sim_params *params);
+void sim_reset(uint64_t seed, bool shared_l1);
+void sim_map(const void *addr, uint64_t len, const char *name);
+void sim_run(void *(*sender)(void *), void *(*receiver)(void *), void *arg, uint64_t deadline);
+bool sim_expired(int agent);
+
+uint64_t sim_time();
+void sim_load(ADDR_PTR addr);
+uint64_t sim_measure(ADDR_PTR addr);
+uint64_t sim_flush(ADDR_PTR addr);
+
+#endif
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE     // CPU_SET, sched_setaffinity
+#include "util.h"
+#include <sched.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+static const char *stress_names[] = { "idle", "stream", "thrash", "sameset", "syscall" };
+
+/*
+ * Working memory of an antagonist, only what its kind needs is allocated.
+ */
+struct stress_state {
+    double *a, *b, *c;                  // stream
+    uint64_t words, pos;
+    char *buffer;                       // thrash
+    uint64_t lines, rng;
+    ADDR_PTR *set_lines;                // sameset
+    uint32_t n, next;
+};
+
+const char *stress_name(StressKind kind)
+{
+    return stress_names[kind];
+}
+
+/*
+ * Parses a profile given as kind[:intensity[:set]], e.g. "stream:0.5" or
+ * "sameset:1:17". The intensity defaults to 1, the set to the default
+ * region of the channel.
+ */
+void stress_parse(const char *arg, struct stress_profile *profile)
+{
+    char kind[16];
+    *profile = (struct stress_profile) { .intensity = 1, .set = CHANNEL_DEFAULT_REGION };
+    if (sscanf(arg, "%15[^:]:%lf:%lu", kind, &profile->intensity, &profile->set) < 1) {
+        fprintf(stderr, "ERROR: empty noise profile\n");
+        exit(-1);
+    }
+
+    uint32_t n = sizeof(stress_names) / sizeof(*stress_names);
+    uint32_t k = 0;
+    while (k < n && strcmp(kind, stress_names[k]) != 0) {
+        k++;
+    }
+    if (k == n) {
+        fprintf(stderr, "ERROR: unknown noise profile %s (idle, stream, thrash, sameset or syscall)\n",
+                kind);
+        exit(-1);
+    }
+    profile->kind = k;
+    if (!(profile->intensity > 0 && profile->intensity <= 1)) {
+        fprintf(stderr, "ERROR: the intensity of %s has to be within (0, 1]\n", arg);
+        exit(-1);
+    }
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *stress_alloc(uint64_t size)
+{
+    char *mem = malloc(size);
+    if (!mem) {
+        fprintf(stderr, "ERROR: cannot allocate %lu bytes of antagonist memory\n", size);
+        exit(-1);
+    }
+    // fault the pages in now rather than while the channel runs
+    memset(mem, 1, size);
+    return mem;
+}
+
+static void stress_setup(const struct stress_profile *profile, struct stress_state *state)
+{
+    uint64_t llc_size = (uint64_t) geometry.l3_sets * geometry.l3_ways * CACHE_LINESIZE;
+    memset(state, 0, sizeof(*state));
+    state->rng = getpid();
+
+    if (profile->kind == StressStream) {
+        // an LLC of each array, so that every pass streams from memory
+        state->words = llc_size / sizeof(double);
+        state->a = stress_alloc(llc_size);
+        state->b = stress_alloc(llc_size);
+        state->c = stress_alloc(llc_size);
+    }
+
+    if (profile->kind == StressThrash) {
+        state->lines = STRESS_THRASH_FACTOR * llc_size / CACHE_LINESIZE;
+        state->buffer = stress_alloc(state->lines * CACHE_LINESIZE);
+    }
+
+    if (profile->kind == StressSameSet) {
+        // the lines of the set in every slice, a few times over its ways
+        uint64_t bsize = STRESS_SAMESET_FACTOR * llc_size;
+        char *buffer = allocate_buffer(bsize);
+        state->n = bsize / ((uint64_t) geometry.l3_slice_sets * CACHE_LINESIZE);
+        state->set_lines = malloc(state->n * sizeof(ADDR_PTR));
+        for (uint32_t i = 0; i < state->n; i++) {
+            state->set_lines[i] = slice_set_line(buffer, profile->set, i);
+            *(char *) state->set_lines[i] = 1;
+        }
+    }
+}
+
+/*
+ * Runs STRESS_CHECK_OPS operations of the kernel of kind.
+ */
+static void stress_burst(StressKind kind, struct stress_state *state)
+{
+    switch (kind) {
+        case StressIdle:
+            break;
+        case StressStream:
+            // a line of each array per operation
+            for (uint32_t op = 0; op < STRESS_CHECK_OPS; op++) {
+                for (uint32_t w = 0; w < CACHE_LINESIZE / sizeof(double); w++) {
+                    state->a[state->pos + w] = state->b[state->pos + w] + 3.0 * state->c[state->pos + w];
+                }
+                state->pos = (state->pos + CACHE_LINESIZE / sizeof(double)) % state->words;
+            }
+            break;
+        case StressThrash:
+            for (uint32_t op = 0; op < STRESS_CHECK_OPS; op++) {
+                state->rng ^= state->rng << 13;
+                state->rng ^= state->rng >> 7;
+                state->rng ^= state->rng << 17;
+                (*(volatile char *) (state->buffer + state->rng % state->lines * CACHE_LINESIZE))++;
+            }
+            break;
+        case StressSameSet:
+            for (uint32_t op = 0; op < STRESS_CHECK_OPS; op++) {
+                *(volatile char *) state->set_lines[state->next];
+                state->next = (state->next + 1) % state->n;
+            }
+            break;
+        case StressSyscall:
+            for (uint32_t op = 0; op < STRESS_CHECK_OPS; op++) {
+                syscall(SYS_getppid);
+                if (op % STRESS_SYSCALL_BURST == STRESS_SYSCALL_BURST - 1) {
+                    struct timespec nap = { 0, 1000 };
+                    nanosleep(&nap, NULL);
+                }
+            }
+            break;
+    }
+}
+
+/*
+ * Works for the intensity of every period and sleeps the rest, until
+ * killed.
+ */
+static void stress_loop(const struct stress_profile *profile)
+{
+    struct stress_state state;
+    stress_setup(profile, &state);
+
+    uint64_t busy = profile->intensity * STRESS_PERIOD_NS;
+    uint64_t period_t = now_ns();
+    while (true) {
+        while (now_ns() - period_t < busy) {
+            stress_burst(profile->kind, &state);
+        }
+        period_t += STRESS_PERIOD_NS;
+        uint64_t now = now_ns();
+        if (now < period_t) {
+            struct timespec nap = { 0, period_t - now };
+            nanosleep(&nap, NULL);
+        } else {
+            period_t = now;
+        }
+    }
+}
+
+/*
+ * Starts one antagonist of profile pinned to each of the cores. They die
+ * with the calling process.
+ */
+void stress_start(struct stress *stress, const struct stress_profile *profile,
+                  const int *cores, uint32_t n_cores)
+{
+    stress->n = 0;
+    if (profile->kind == StressIdle)
+        return;
+
+    geometry_detect();
+    if (profile->set >= geometry.l3_slice_sets) {
+        fprintf(stderr, "ERROR: set %lu is out of the %u sets of an LLC slice\n",
+                profile->set, geometry.l3_slice_sets);
+        exit(-1);
+    }
+
+    pid_t parent = getpid();
+    fflush(stdout);
+    for (uint32_t i = 0; i < n_cores; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            fprintf(stderr, "ERROR: fork failed: %s\n", strerror(errno));
+            exit(-1);
+        }
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() != parent)
+                _exit(0);
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            close(null);
+            stress_loop(profile);
+        }
+
+        stress->pids[stress->n++] = pid;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cores[i], &set);
+        if (sched_setaffinity(pid, sizeof(set), &set) == -1) {
+            fprintf(stderr, "ERROR: cannot pin the %s antagonist to core %d: %s\n",
+                    stress_name(profile->kind), cores[i], strerror(errno));
+            stress_stop(stress);
+            exit(-1);
+        }
+    }
+}
+
+void stress_stop(struct stress *stress)
+{
+    for (uint32_t i = 0; i < stress->n; i++) {
+        kill(stress->pids[i], SIGKILL);
+        waitpid(stress->pids[i], NULL, 0);
+    }
+    stress->n = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef STRESS_H_
+#define STRESS_H_
+
+// Included from util.h, which provides the standard headers.
+
+/*
+ * Antagonists co-running with the sender and receiver, to measure the channel
+ * under load (ccbench -N). Each one is a process pinned to a core of its own
+ * that works for intensity of every STRESS_PERIOD_NS and sleeps the rest:
+ * - stream:  STREAM triad over three arrays of the LLC size, memory bandwidth
+ * - thrash:  read-modify-write of random lines of twice the LLC
+ * - sameset: walks lines of every slice congruent with one LLC set (region 0
+ *            of the channel by default)
+ * - syscall: cheap system calls and microsecond sleeps, a storm of kernel
+ *            entries, timer interrupts and context switches
+ */
+#define STRESS_MAX_PROFILES     16
+#define STRESS_MAX_CORES        64
+#define STRESS_PERIOD_NS        1000000
+#define STRESS_THRASH_FACTOR    2       // LLC sizes of the random buffer
+#define STRESS_SAMESET_FACTOR   2       // lines per LLC way of the set, in every slice
+#define STRESS_SYSCALL_BURST    64      // system calls between sleeps
+#define STRESS_CHECK_OPS        256     // operations between clock reads
+
+typedef enum _stress_kind {
+    StressIdle = 0,
+    StressStream,
+    StressThrash,
+    StressSameSet,
+    StressSyscall
+} StressKind;
+
+struct stress_profile {
+    StressKind kind;
+    double intensity;                   // busy fraction of each period, 0 to 1
+    uint64_t set;                       // LLC set of sameset
+};
+
+struct stress {
+    pid_t pids[STRESS_MAX_CORES];
+    uint32_t n;
+};
+
+void stress_parse(const char *arg, struct stress_profile *profile);
+const char *stress_name(StressKind kind);
+void stress_start(struct stress *stress, const struct stress_profile *profile,
+                  const int *cores, uint32_t n_cores);
+void stress_stop(struct stress *stress);
+
+#endif
@@ -0,0 +1,135 @@
+#include "util.h"
+#include <stddef.h>
+
+struct telemetry telemetry;
+
+/*
+ * Returns the upper bound in cycles of the bucket holding the given fraction
+ * of the count samples of a latency histogram.
+ */
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t count, double fraction)
+{
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < TELEMETRY_HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= fraction * count)
+            return (uint64_t) (b + 1) << TELEMETRY_HIST_SHIFT;
+    }
+    return (uint64_t) TELEMETRY_HIST_BUCKETS << TELEMETRY_HIST_SHIFT;
+}
+
+static void print_phase(const char *name, uint64_t budget, size_t offset)
+{
+    uint64_t total = 0, max = 0, over = 0;
+    for (uint64_t i = 0; i < telemetry.header.kept; i++) {
+        uint32_t cycles = *(uint32_t *) ((char *) &telemetry.records[i] + offset);
+        total += cycles;
+        max = cycles > max? cycles: max;
+        over += cycles > budget + TELEMETRY_OVERRUN_SLACK;
+    }
+    printf("  %-8s %10lu %10.0f %10lu %12lu\n", name, budget,
+           (double) total / telemetry.header.kept, max, over);
+}
+
+/*
+ * Writes the ring and histograms to the telemetry path and prints where
+ * the interval budget went. Registered with atexit.
+ */
+static void telemetry_dump(void)
+{
+    struct telemetry_header *header = &telemetry.header;
+    header->records = telemetry.head;
+    header->kept = telemetry.head < TELEMETRY_RING_RECORDS? telemetry.head: TELEMETRY_RING_RECORDS;
+
+    // unroll the ring, oldest record first
+    uint64_t first = telemetry.head - header->kept;
+    struct telemetry_record *ordered = malloc(header->kept * sizeof(*ordered));
+    for (uint64_t i = 0; i < header->kept; i++) {
+        ordered[i] = telemetry.records[(first + i) & (TELEMETRY_RING_RECORDS - 1)];
+    }
+    free(telemetry.records);
+    telemetry.records = ordered;
+
+    FILE *f = fopen(telemetry.path, "w");
+    if (!f ||
+        fwrite(header, sizeof(*header), 1, f) != 1 ||
+        fwrite(ordered, sizeof(*ordered), header->kept, f) != header->kept ||
+        fwrite(telemetry.hist, sizeof(uint64_t) * TELEMETRY_HIST_BUCKETS,
+               header->width, f) != header->width ||
+        fclose(f) != 0) {
+        fprintf(stderr, "ERROR: cannot write telemetry to %s\n", telemetry.path);
+        return;
+    }
+
+    printf("Telemetry of %lu intervals (last %lu) written to %s\n",
+           header->records, header->kept, telemetry.path);
+    if (header->kept == 0)
+        return;
+    printf("  %-8s %10s %10s %10s %12s\n", "phase", "budget", "mean", "max", "over budget");
+    print_phase("prime", header->prime_period, offsetof(struct telemetry_record, prime));
+    print_phase("access", header->access_period, offsetof(struct telemetry_record, access));
+    print_phase("probe", header->probe_period, offsetof(struct telemetry_record, probe));
+
+    uint64_t late = 0, max_late = 0, overruns = 0, max_overrun = 0, samples = 0, outliers = 0;
+    for (uint64_t i = 0; i < header->kept; i++) {
+        late += ordered[i].late > TELEMETRY_OVERRUN_SLACK;
+        max_late = ordered[i].late > max_late? ordered[i].late: max_late;
+        overruns += ordered[i].overrun > TELEMETRY_OVERRUN_SLACK;
+        max_overrun = ordered[i].overrun > max_overrun? ordered[i].overrun: max_overrun;
+        samples += ordered[i].samples;
+        outliers += ordered[i].outliers;
+    }
+    printf("  late starts %lu (max %lu cycles), deadline overruns %lu (max %lu cycles)\n",
+           late, max_late, overruns, max_overrun);
+    if (samples + outliers == 0)
+        return;
+    printf("  outliers discarded %lu of %lu probes\n", outliers, samples + outliers);
+    for (uint32_t k = 0; k < header->width; k++) {
+        const uint64_t *hist = telemetry.hist + k * TELEMETRY_HIST_BUCKETS;
+        uint64_t count = 0;
+        for (uint32_t b = 0; b < TELEMETRY_HIST_BUCKETS; b++) {
+            count += hist[b];
+        }
+        if (count) {
+            printf("  set %u probe latency p50 <%lu p90 <%lu p99 <%lu cycles\n", k,
+                   hist_percentile(hist, count, 0.5), hist_percentile(hist, count, 0.9),
+                   hist_percentile(hist, count, 0.99));
+        }
+    }
+}
+
+/*
+ * Enables telemetry for a channel of width sets with the given phase budgets,
+ * to be written to path at exit. The ring and histograms are touched here so that the timing loop
+ * never page faults on them.
+ */
+void telemetry_init(const char *path, uint32_t width, uint64_t interval,
+                    uint64_t prime_period, uint64_t access_period, uint64_t probe_period)
+{
+    size_t ring_size = TELEMETRY_RING_RECORDS * sizeof(struct telemetry_record);
+    size_t hist_size = width * TELEMETRY_HIST_BUCKETS * sizeof(uint64_t);
+    telemetry.records = malloc(ring_size);
+    telemetry.hist = malloc(hist_size);
+    if (!telemetry.records || !telemetry.hist) {
+        fprintf(stderr, "ERROR: cannot allocate the telemetry ring\n");
+        exit(-1);
+    }
+    memset(telemetry.records, 0, ring_size);
+    memset(telemetry.hist, 0, hist_size);
+
+    telemetry.head = 0;
+    telemetry.path = path;
+    telemetry.header = (struct telemetry_header) {
+        .magic = TELEMETRY_MAGIC,
+        .version = TELEMETRY_VERSION,
+        .interval = interval,
+        .prime_period = prime_period,
+        .access_period = access_period,
+        .probe_period = probe_period,
+        .record_size = sizeof(struct telemetry_record),
+        .width = width,
+        .hist_shift = TELEMETRY_HIST_SHIFT,
+        .hist_buckets = TELEMETRY_HIST_BUCKETS,
+    };
+    atexit(telemetry_dump);
+}
@@ -0,0 +1,89 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+// Included from util.h, which provides the standard headers.
+
+/*
+ * Hot-path telemetry (-t path): one record per interval in a preallocated
+ * ring, plus a probe latency histogram per set. The timing loop only stores
+ * to memory, the ring is written to path with a summary when the program
+ * exits. Only the timing loop writes head, so no locking is needed.
+ */
+#define TELEMETRY_RING_RECORDS  (1 << 16)       // power of two, oldest overwritten
+#define TELEMETRY_HIST_SHIFT    4               // 16 cycles per latency bucket
+#define TELEMETRY_HIST_BUCKETS  64              // the last one holds the rest
+#define TELEMETRY_OVERRUN_SLACK 1024            // cycles late or past a deadline still on time
+#define TELEMETRY_MAGIC         0x4d544343      // "CCTM"
+#define TELEMETRY_VERSION       1
+
+/*
+ * Cycles spent in each phase of an interval. The sender's prime is its wait
+ * for the receiver to prime, its access the eviction. Overrun is how far the
+ * work ran past its deadline (the access window for the sender, the interval
+ * for the receiver), late how far past its start the interval began.
+ */
+struct telemetry_record {
+    uint64_t start_t;
+    uint32_t late;
+    uint32_t prime;
+    uint32_t access;
+    uint32_t probe;
+    uint32_t overrun;
+    uint32_t ops;               // lines primed (receiver) or accessed (sender)
+    uint16_t samples;           // valid probe measurements
+    uint16_t outliers;          // probe measurements over the outlier threshold
+    uint32_t reserved;
+};
+
+/*
+ * Header of the binary dump, followed by the kept records oldest first and
+ * width x TELEMETRY_HIST_BUCKETS uint64_t histogram counts.
+ */
+struct telemetry_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t interval;          // budgets of the phases
+    uint64_t prime_period;
+    uint64_t access_period;
+    uint64_t probe_period;
+    uint64_t records;           // recorded in total
+    uint64_t kept;              // in the dump
+    uint32_t record_size;
+    uint32_t width;
+    uint32_t hist_shift;
+    uint32_t hist_buckets;
+};
+
+struct telemetry {
+    struct telemetry_record *records;   // NULL when disabled
+    uint64_t head;
+    uint64_t *hist;
+    const char *path;
+    struct telemetry_header header;
+};
+
+extern struct telemetry telemetry;
+
+void telemetry_init(const char *path, uint32_t width, uint64_t interval,
+                    uint64_t prime_period, uint64_t access_period, uint64_t probe_period);
+
+/*
+ * Returns the record of the next interval, or NULL when disabled.
+ */
+static inline struct telemetry_record *telemetry_next(void)
+{
+    if (!telemetry.records)
+        return NULL;
+    return &telemetry.records[telemetry.head++ & (TELEMETRY_RING_RECORDS - 1)];
+}
+
+static inline void telemetry_latency(uint32_t set, uint64_t time)
+{
+    if (!telemetry.hist)
+        return;
+    uint64_t bucket = time >> TELEMETRY_HIST_SHIFT;
+    bucket = bucket < TELEMETRY_HIST_BUCKETS? bucket: TELEMETRY_HIST_BUCKETS - 1;
+    telemetry.hist[set * TELEMETRY_HIST_BUCKETS + bucket]++;
+}
+
+#endif
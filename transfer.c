@@ -0,0 +1,296 @@
+#include "util.h"
+
+/*
+ * Reads until the chunk is full or the input ends.
+ */
+static size_t fill_chunk(int fd, uint8_t *chunk, bool *eof)
+{
+    size_t len = 0;
+    while (len < TRANSFER_CHUNK_BYTES) {
+        ssize_t ret = read(fd, chunk + len, TRANSFER_CHUNK_BYTES - len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: failed to read input: %s\n", strerror(errno));
+            exit(-1);
+        }
+        if (ret == 0) {
+            *eof = true;
+            break;
+        }
+        len += ret;
+    }
+    return len;
+}
+
+static void drain_chunk(struct transfer *t, const uint8_t *chunk, size_t len)
+{
+    while (len > 0) {
+        ssize_t ret = write(t->fd, chunk, len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: failed to write output: %s\n", strerror(errno));
+            exit(-1);
+        }
+        chunk += ret;
+        len -= ret;
+    }
+}
+
+/*
+ * Helper thread: refills or drains whichever chunk the timing loop is not
+ * using, then hands it back by flipping ready.
+ */
+static void *transfer_thread(void *arg)
+{
+    struct transfer *t = arg;
+
+    pthread_mutex_lock(&t->lock);
+    while (true) {
+        // input refills the consumed chunk, output drains the filled one
+        bool work = t->output? t->ready: !t->ready && !t->eof;
+        if (!work) {
+            if (t->done || t->eof)
+                break;
+            pthread_cond_wait(&t->cond, &t->lock);
+            continue;
+        }
+
+        int other = !t->active;
+        bool eof = false;
+        pthread_mutex_unlock(&t->lock);
+        if (t->output) {
+            drain_chunk(t, t->chunks[other], t->chunk_len[other]);
+        } else {
+            t->chunk_len[other] = fill_chunk(t->fd, t->chunks[other], &eof);
+        }
+        pthread_mutex_lock(&t->lock);
+
+        t->eof = eof;
+        t->ready = !t->output && t->chunk_len[other] > 0;
+        pthread_cond_signal(&t->cond);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+static void transfer_init(struct transfer *t, int fd, bool output)
+{
+    memset(t, 0, sizeof(*t));
+    t->fd = fd;
+    t->output = output;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    transfer_start(t);
+}
+
+static void transfer_spawn(struct transfer *t)
+{
+    for (int i = 0; i < 2; i++) {
+        t->chunks[i] = malloc(TRANSFER_CHUNK_BYTES);
+        if (t->chunks[i] == NULL) {
+            fprintf(stderr, "ERROR: failed to allocate transfer buffers\n");
+            exit(-1);
+        }
+    }
+    if (!t->output) {
+        t->chunk_len[0] = fill_chunk(t->fd, t->chunks[0], &t->eof);
+    }
+    if (pthread_create(&t->thread, NULL, transfer_thread, t) != 0) {
+        fprintf(stderr, "ERROR: failed to start transfer thread\n");
+        exit(-1);
+    }
+}
+
+/*
+ * Opens the file to send, "-" being stdin. Regular files are mapped and
+ * prefaulted up front, anything else is read ahead by the helper thread.
+ */
+void transfer_open_input(struct transfer *t, const char *filename)
+{
+    int fd = strcmp(filename, "-") == 0? STDIN_FILENO: open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: failed to open %s: %s\n", filename, strerror(errno));
+        exit(-1);
+    }
+    transfer_init(t, fd, false);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        t->map_len = st.st_size;
+        if (t->map_len > 0) {
+            t->map = mmap(NULL, t->map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (t->map == MAP_FAILED) {
+                fprintf(stderr, "ERROR: failed to map %s\n", filename);
+                exit(-1);
+            }
+            madvise(t->map, t->map_len, MADV_SEQUENTIAL);
+        }
+        return;
+    }
+    transfer_spawn(t);
+}
+
+static int stdout_fd = -1;
+
+/*
+ * Keeps stdout for the received data and moves the progress messages
+ * printed on it over to stderr. Returns the descriptor of the real stdout.
+ */
+int transfer_claim_stdout()
+{
+    if (stdout_fd == -1) {
+        fflush(stdout);
+        stdout_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    return stdout_fd;
+}
+
+/*
+ * Opens the file to receive into, "-" being stdout.
+ */
+void transfer_open_output(struct transfer *t, const char *filename)
+{
+    int fd;
+    if (strcmp(filename, "-") == 0) {
+        fd = transfer_claim_stdout();
+    } else {
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: failed to open %s: %s\n", filename, strerror(errno));
+        exit(-1);
+    }
+    transfer_init(t, fd, true);
+    transfer_spawn(t);
+}
+
+/*
+ * Restarts the clock that transfer_report measures the transfer time from.
+ */
+void transfer_start(struct transfer *t)
+{
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+/*
+ * Copies up to len bytes of input into data, only falling short at the end
+ * of the input. Waits on the helper thread only if it fell behind.
+ */
+size_t transfer_read(struct transfer *t, uint8_t *data, size_t len)
+{
+    size_t count = 0;
+
+    if (t->map || t->chunks[0] == NULL) {
+        count = t->map_len - t->pos < len? t->map_len - t->pos: len;
+        memcpy(data, t->map + t->pos, count);
+        t->pos += count;
+    }
+
+    while (count < len && t->chunks[0]) {
+        size_t avail = t->chunk_len[t->active] - t->pos;
+        if (avail == 0) {
+            pthread_mutex_lock(&t->lock);
+            while (!t->ready && !t->eof)
+                pthread_cond_wait(&t->cond, &t->lock);
+            bool more = t->ready;
+            if (more) {
+                t->active = !t->active;
+                t->pos = 0;
+                t->ready = false;
+                pthread_cond_signal(&t->cond);
+            }
+            pthread_mutex_unlock(&t->lock);
+            if (!more)
+                break;
+            continue;
+        }
+
+        size_t n = avail < len - count? avail: len - count;
+        memcpy(data + count, t->chunks[t->active] + t->pos, n);
+        t->pos += n;
+        count += n;
+    }
+
+    t->crc = crc32(t->crc, data, count);
+    t->bytes += count;
+    return count;
+}
+
+/*
+ * Appends len bytes to the output. Full chunks are handed to the helper
+ * thread, which only blocks the caller if the output cannot keep up.
+ */
+void transfer_write(struct transfer *t, const uint8_t *data, size_t len)
+{
+    t->crc = crc32(t->crc, data, len);
+    t->bytes += len;
+
+    while (len > 0) {
+        size_t room = TRANSFER_CHUNK_BYTES - t->pos;
+        size_t n = room < len? room: len;
+        memcpy(t->chunks[t->active] + t->pos, data, n);
+        t->pos += n;
+        data += n;
+        len -= n;
+
+        if (t->pos == TRANSFER_CHUNK_BYTES) {
+            pthread_mutex_lock(&t->lock);
+            while (t->ready)
+                pthread_cond_wait(&t->cond, &t->lock);
+            t->chunk_len[t->active] = t->pos;
+            t->active = !t->active;
+            t->pos = 0;
+            t->ready = true;
+            pthread_cond_signal(&t->cond);
+            pthread_mutex_unlock(&t->lock);
+        }
+    }
+}
+
+/*
+ * Writes out what is left of the output, stops the helper thread and
+ * releases the file and buffers. The statistics stay valid.
+ */
+void transfer_close(struct transfer *t)
+{
+    if (t->chunks[0]) {
+        pthread_mutex_lock(&t->lock);
+        while (t->output && t->ready)
+            pthread_cond_wait(&t->cond, &t->lock);
+        t->done = true;
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+        pthread_join(t->thread, NULL);
+
+        if (t->output) {
+            drain_chunk(t, t->chunks[t->active], t->pos);
+        }
+        free(t->chunks[0]);
+        free(t->chunks[1]);
+    }
+    if (t->map) {
+        munmap(t->map, t->map_len);
+    }
+    if (t->fd > STDERR_FILENO) {
+        close(t->fd);
+    }
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->cond);
+}
+
+/*
+ * Prints the size, time and goodput of the transfer with the CRC-32 of its
+ * bytes, which both sides print for comparison.
+ */
+void transfer_report(const struct transfer *t, const char *verb, uint32_t frames)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - t->start.tv_sec) + (end.tv_nsec - t->start.tv_nsec) / 1e9;
+
+    printf("%s %zu bytes in %u frames in %.3f s, goodput %.1f bytes/s, CRC-32 %08x\n",
+           verb, t->bytes, frames, secs, secs > 0? t->bytes / secs: 0, t->crc);
+}
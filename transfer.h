@@ -0,0 +1,49 @@
+#ifndef TRANSFER_H_
+#define TRANSFER_H_
+
+// Included from util.h, which provides the standard headers.
+#include <pthread.h>
+
+/*
+ * Streams a file (or stdin/stdout for "-") in and out of the bit-timing loop.
+ * Regular input files are mmap'd; pipes are read, and output is written, by
+ * a helper thread over two chunks so that the timing loop only ever copies
+ * bytes and never waits on I/O.
+ */
+#define TRANSFER_CHUNK_BYTES    (1 << 16)
+
+struct transfer {
+    int fd;
+    bool output;
+
+    // whole input file when it could be mmap'd
+    uint8_t *map;
+    size_t map_len;
+
+    // chunks[active] belongs to the timing loop, the other one to the thread
+    uint8_t *chunks[2];
+    size_t chunk_len[2];
+    size_t pos;
+    int active;
+    bool ready;     // the other chunk is filled (input) or waits to be written (output)
+    bool eof;
+    bool done;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    size_t bytes;
+    uint32_t crc;
+    struct timespec start;
+};
+
+void transfer_open_input(struct transfer *t, const char *filename);
+int transfer_claim_stdout();
+void transfer_open_output(struct transfer *t, const char *filename);
+void transfer_start(struct transfer *t);
+size_t transfer_read(struct transfer *t, uint8_t *data, size_t len);
+void transfer_write(struct transfer *t, const uint8_t *data, size_t len);
+void transfer_close(struct transfer *t);
+void transfer_report(const struct transfer *t, const char *verb, uint32_t frames);
+
+#endif
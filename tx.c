@@ -0,0 +1,299 @@
+#include "util.h"
+
+// sender function pointer, sends a symbol in the slot starting at start_t
+void (*send_symbol)(uint64_t, uint64_t, const struct config*);
+
+/*
+ * Builds the eviction sets of the regions of the channel (or maps the
+ * shared file) and selects the sender. pid marks the pages in use.
+ */
+void tx_init(struct config *config, uint64_t pid) {
+    if (config->channel == PrimeProbe) {
+        // The lines of a region are a slice apart, and the sender takes
+        // enough of them to fill the ways of every slice it covers: all of
+        // them, or up to EVSET_MAX_SLICES when -e keeps only minimal sets.
+        // Huge pages each hold lines of every region, so the whole span is
+        // backed there, small pages only back the lines touched.
+        uint32_t slices = geometry.l3_slices;
+        if (config->discover_evsets && slices > EVSET_MAX_SLICES) {
+            slices = EVSET_MAX_SLICES;
+        }
+        uint32_t max_candidates = CHANNEL_SENDER_WAY_LINES * geometry.l3_ways * slices;
+        uint64_t bsize = (uint64_t) max_candidates * geometry.l3_slice_sets * CACHE_LINESIZE;
+        config->buffer = allocate_buffer(bsize);
+        printf("buffer pointer addr %p\n", config->buffer);
+
+        // Construct one addr_set per region from the lines with the cache
+        // set index of that region, or collect them as candidates when the
+        // eviction sets are discovered by timing. Only these lines are made
+        // non-zero, so only the pages that hold them are backed.
+        uint32_t addr_set_size[MAX_CHANNEL_WIDTH] = {0};
+        ADDR_PTR *candidates[MAX_CHANNEL_WIDTH] = {NULL};
+        for (uint32_t k = 0; k < config->width; k++) {
+            if (config->discover_evsets) {
+                candidates[k] = malloc(max_candidates * sizeof(ADDR_PTR));
+            }
+            for (uint32_t n = 0; n < max_candidates; n++) {
+                ADDR_PTR addr = slice_set_line(config->buffer, config->cache_regions[k], n);
+                *(char *) addr = pid;
+                if (config->discover_evsets) {
+                    candidates[k][n] = addr;
+                } else {
+                    evset_append(&config->addr_sets[k], addr);
+                }
+            }
+            addr_set_size[k] = max_candidates;
+        }
+        for (uint32_t k = 0; k < config->width; k++) {
+            // The receiver monitors a single slice, which is unknown to us,
+            // so send over the minimal sets of every slice of the region
+            if (config->discover_evsets) {
+                uint32_t slices = find_evset(config, "sender", k, bsize, EVSET_MAX_SLICES,
+                                             candidates[k], addr_set_size[k]);
+                printf("Using %u minimal eviction sets for region %lu\n",
+                       slices, config->cache_regions[k]);
+                addr_set_size[k] = config->addr_sets[k].size;
+                free(candidates[k]);
+                if (slices == 0) {
+                    fprintf(stderr, "ERROR: no eviction set found for region %lu!\n",
+                            config->cache_regions[k]);
+                    exit(-1);
+                }
+            }
+            // shuffle the lines in physical address space
+            evset_shuffle(&config->addr_sets[k], config->evset_seed);
+            printf("Found addr_set size of %u for region %lu\n",
+                   addr_set_size[k], config->cache_regions[k]);
+        }
+    }
+
+    if (config->channel == L1DPrimeProbe) {
+        // restrict the probing set to the L1 ways to aviod self eviction,
+        // and a multi-level set to exactly those ways so that each level
+        // evicts its share of the receiver's lines
+        uint32_t set_limit = config->levels > 2? geometry.l1_ways:
+                             2 * (geometry.l1_ways + geometry.l2_ways);
+        uint64_t bsize = (uint64_t) set_limit * geometry.l3_slice_sets * CACHE_LINESIZE;
+        config->buffer = allocate_buffer(bsize);
+        printf("buffer pointer addr %p\n", config->buffer);
+
+        // Construct one addr_set per region from the first set_limit lines
+        // with the cache set index of that region, touching only those.
+        uint32_t addr_set_size[MAX_CHANNEL_WIDTH] = {0};
+        for (uint32_t k = 0; k < config->width; k++) {
+            for (uint32_t n = 0; n < set_limit; n++) {
+                ADDR_PTR addr = slice_set_line(config->buffer, config->cache_regions[k], n);
+                *(char *) addr = pid;
+                evset_append(&config->addr_sets[k], addr);
+            }
+            addr_set_size[k] = set_limit;
+        }
+
+        for (uint32_t k = 0; k < config->width; k++) {
+            evset_shuffle(&config->addr_sets[k], config->evset_seed);
+            printf("Found addr_set size of %u for region %lu\n",
+                   addr_set_size[k], config->cache_regions[k]);
+        }
+
+    }
+
+    if (shared_memory_channel(config->channel)) {
+        map_shared_file(config);
+    }
+
+    if (config->channel == PrimeProbe || config->channel == L1DPrimeProbe) {
+        send_symbol = send_symbol_pp;
+    }
+    else if (config->channel == FlushReload) {
+        send_symbol = send_symbol_fr;
+    }
+    else if (config->channel == FlushFlush) {
+        send_symbol = send_symbol_ff;
+    }
+}
+
+
+/*
+ * Sends the same bit over every region of the channel.
+ */
+void send_bit(bool one, uint64_t start_t, const struct config *config) {
+    send_symbol(one? level_symbol(config->levels - 1, config): 0, start_t, config);
+}
+
+/*
+ * Sends a symbol by flushing (F+R) or accessing (F+F) the line of every
+ * region whose bit is one, round robin, for the whole slot starting at
+ * start_t. Inlined into both so that the loop has no channel test.
+ */
+static inline __attribute__((always_inline))
+void send_symbol_lines(uint64_t symbol, uint64_t start_t, const struct config *config,
+                       bool flush) {
+    struct telemetry_record *record = telemetry_next();
+    uint64_t now = rdtsc();
+
+    ADDR_PTR lines[MAX_CHANNEL_WIDTH];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < config->width; i++) {
+        uint32_t k = config->line_order[i];
+        if ((symbol >> k) & 1)
+            lines[n++] = config->addr_sets[k].head;
+    }
+    while (rdtsc() < start_t) {}
+
+    uint64_t ops = 0;
+    if (n > 0) {
+        while ((rdtsc() - start_t) < config->interval) {
+            for (uint32_t i = 0; i < n; i++) {
+                if (flush)
+                    clflush(lines[i]);
+                else
+                    load_line(lines[i]);
+            }
+            ops += n;
+        }
+    }
+
+    if (record) {
+        uint64_t end = rdtsc();
+        *record = (struct telemetry_record) {
+            .start_t = start_t,
+            .late = now > start_t? now - start_t: 0,
+            .access = n > 0? end - start_t: 0,
+            .overrun = end > start_t + config->interval? end - start_t - config->interval: 0,
+            .ops = ops,
+        };
+    }
+}
+
+void send_symbol_fr(uint64_t symbol, uint64_t start_t, const struct config *config) {
+    send_symbol_lines(symbol, start_t, config, true);
+}
+
+// F+F: the receiver times its flushes, which take longer on a cached line
+void send_symbol_ff(uint64_t symbol, uint64_t start_t, const struct config *config) {
+    send_symbol_lines(symbol, start_t, config, false);
+}
+
+/*
+ * Sends a symbol to the receiver by repeatedly accessing the addresses of the
+ * addr_set of every region whose level is not zero for the access period of
+ * the slot starting at start_t, or by doing nothing when the symbol is zero.
+ * Level l of n only walks the first l/(n-1) of the set, so that it evicts
+ * that share of the lines primed by the receiver.
+ *
+ * Accesses are interleaved across the sets so that all regions get evicted
+ * within the same access window.
+ */
+void send_symbol_pp(uint64_t symbol, uint64_t start_t, const struct config *config)
+{
+    struct telemetry_record *record = telemetry_next();
+    uint64_t now = get_time();
+    while (get_time() < start_t) {}
+    debug("time %lx\n", start_t);
+
+    uint64_t access_count = 0, access_t = start_t;
+    if (symbol) {
+        // wait for receiver to prime the cache sets
+        while (get_time() - start_t < config->prime_period) {}
+
+        // access
+        access_t = get_time();
+        ADDR_PTR current[MAX_CHANNEL_WIDTH];
+        uint32_t lines[MAX_CHANNEL_WIDTH], walked[MAX_CHANNEL_WIDTH] = {0};
+        uint64_t level_mask = (1ULL << config->level_bits) - 1;
+        uint64_t stopTime = start_t + config->prime_period + config->access_period;
+        // uint64_t stopTime = start_t + config->interval;
+        for (uint32_t k = 0; k < config->width; k++) {
+            uint32_t level = bits_to_level((symbol >> (k * config->level_bits)) & level_mask);
+            lines[k] = level * config->addr_sets[k].size / (config->levels - 1);
+            current[k] = config->addr_sets[k].head;
+        }
+        // keep walking the lines of each level until the access period ends
+        do {
+            for (uint32_t k = 0; k < config->width; k++) {
+                if (lines[k] == 0)
+                    continue;
+                current[k] = evset_next(current[k]);
+                if (++walked[k] == lines[k]) {
+                    walked[k] = 0;
+                    current[k] = config->addr_sets[k].head;
+                }
+                access_count++;
+            }
+        } while (get_time() < stopTime);
+        debug("access count %lu time %lx\n", access_count, get_time() - start_t);
+
+        // the receiver probes for the rest of the slot,
+        // the next symbol waits for its own slot
+    }
+
+    if (record) {
+        uint64_t end = get_time(), deadline = start_t + config->prime_period + config->access_period;
+        *record = (struct telemetry_record) {
+            .start_t = start_t,
+            .late = now > start_t? now - start_t: 0,
+            .prime = access_t - start_t,
+            .access = symbol? end - access_t: 0,
+            .overrun = symbol && end > deadline? end - deadline: 0,
+            .ops = access_count,
+        };
+    }
+}
+
+/*
+ * Sends a '101010101011' start string on consecutive slots from start_t to
+ * let the receiver find the schedule, followed by the training sequence of
+ * a multi-level channel. Returns the start of the next slot.
+ */
+uint64_t send_preamble(uint64_t start_t, const struct config *config) {
+    for (int i = 0; i < 10; i++) {
+        send_bit(i % 2 == 0, start_t, config);
+        start_t += config->interval;
+    }
+    send_bit(true, start_t, config);
+    start_t += config->interval;
+    send_bit(true, start_t, config);
+    start_t += config->interval;
+
+    // multi-level channels follow with every level in turn to train on
+    if (config->levels > 2) {
+        for (int i = 0; i < CHANNEL_TRAINING_REPEATS; i++) {
+            for (uint32_t level = 0; level < config->levels; level++) {
+                send_symbol(level_symbol(level, config), start_t, config);
+                start_t += config->interval;
+            }
+        }
+    }
+    return start_t;
+}
+
+/*
+ * Sends the bits of wire on consecutive slots from start_t, symbol_bits(config)
+ * at a time. With Manchester coding every symbol is followed by its
+ * complement. Returns the start of the next slot.
+ */
+uint64_t send_bits(const struct bitstream *wire, uint64_t start_t, const struct config *config) {
+    uint64_t complement = level_symbol(config->levels - 1, config);
+    struct bitreader reader = { wire, 0 };
+    while (!br_done(&reader)) {
+        uint64_t symbol = br_read(&reader, symbol_bits(config));
+        send_symbol(symbol, start_t, config);
+        start_t += config->interval;
+        if (config->manchester) {
+            send_symbol(symbol ^ complement, start_t, config);
+            start_t += config->interval;
+        }
+    }
+    return start_t;
+}
+
+/*
+ * Sends one frame on the slots following start_t, returns the start of the
+ * next slot. wire is scratch space kept by the caller across frames.
+ */
+uint64_t send_frame(const struct frame *frame, struct bitstream *wire,
+                    uint64_t start_t, const struct config *config) {
+    bs_clear(wire);
+    frame_encode(frame, config->fec, wire);
+    return send_bits(wire, start_t, config);
+}
@@ -0,0 +1,25 @@
+#ifndef TX_H_
+#define TX_H_
+
+// Included from util.h after struct config, which provides the standard headers.
+
+/*
+ * Sending end of the channel: eviction sets, symbols on the slot schedule
+ * and frames. Linked into the sender, and into the receiver for the reverse
+ * channel of ARQ transfers.
+ */
+
+// sender function pointer, sends a symbol in the slot starting at start_t
+extern void (*send_symbol)(uint64_t, uint64_t, const struct config*);
+
+void tx_init(struct config *config, uint64_t pid);
+void send_bit(bool one, uint64_t start_t, const struct config *config);
+void send_symbol_fr(uint64_t symbol, uint64_t start_t, const struct config *config);
+void send_symbol_ff(uint64_t symbol, uint64_t start_t, const struct config *config);
+void send_symbol_pp(uint64_t symbol, uint64_t start_t, const struct config *config);
+uint64_t send_preamble(uint64_t start_t, const struct config *config);
+uint64_t send_bits(const struct bitstream *wire, uint64_t start_t, const struct config *config);
+uint64_t send_frame(const struct frame *frame, struct bitstream *wire,
+                    uint64_t start_t, const struct config *config);
+
+#endif
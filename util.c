@@ -4,6 +4,9 @@
 /* Measure the time it takes to access a block with virtual address addr. */
 extern inline __attribute__((always_inline))
 uint64_t measure_one_block_access_time(ADDR_PTR addr) {
+#ifdef SIMULATOR
+    return sim_measure(addr);
+#else
     uint64_t cycles;
 
     asm volatile("mov %1, %%r8\n\t"
@@ -21,6 +24,24 @@ uint64_t measure_one_block_access_time(ADDR_PTR addr) {
     : "r8", "edi");
 
     return cycles;
+#endif
+}
+
+/*
+ * Returns the cycles taken by clflush on addr, which are more when the line
+ * is cached somewhere than when it is not. The line is left uncached.
+ */
+extern inline __attribute__((always_inline))
+uint64_t measure_flush_time(ADDR_PTR addr) {
+#ifdef SIMULATOR
+    return sim_flush(addr);
+#else
+    asm volatile("mfence");
+    uint64_t start = rdtsc();
+    asm volatile("clflush (%0)"::"r"(addr));
+    asm volatile("mfence");
+    return rdtsc() - start;
+#endif
 }
 
 /*
@@ -28,25 +49,37 @@ uint64_t measure_one_block_access_time(ADDR_PTR addr) {
  */
 extern inline __attribute__((always_inline))
 void clflush(ADDR_PTR addr) {
+#ifdef SIMULATOR
+    sim_flush(addr);
+#else
     asm volatile ("clflush (%0)"::"r"(addr));
+#endif
 }
 
 extern inline __attribute__((always_inline))
 uint64_t rdtsc() {
+#ifdef SIMULATOR
+    return sim_time();
+#else
     uint64_t a, d;
     asm volatile ("lfence");
     asm volatile ("rdtsc" : "=a" (a), "=d" (d));
     asm volatile ("lfence");
     return (d << 32) | a;
+#endif
 }
 
 extern inline __attribute__((always_inline))
 CYCLES rdtscp(void) {
+#ifdef SIMULATOR
+    return sim_time();
+#else
     CYCLES cycles;
     asm volatile ("rdtscp"
     : /* outputs */ "=a" (cycles));
 
     return cycles;
+#endif
 }
 
 inline uint64_t get_time() {
@@ -54,10 +87,14 @@ inline uint64_t get_time() {
     return rdtsc();
 }
 
-extern inline __attribute__((always_inline))
-uint64_t cc_sync() {
-    while((get_time() & CHANNEL_SYNC_TIMEMASK) > CHANNEL_SYNC_JITTER) {}
-    return get_time();
+/*
+ * Returns the start of the first slot beginning at least CHANNEL_SLOT_GUARD
+ * cycles from now. Slots sit on multiples of the interval of the TSC, which
+ * sender and receiver share, so both sides agree on them without syncing.
+ */
+uint64_t next_slot(const struct config *config) {
+    uint64_t t = get_time() + CHANNEL_SLOT_GUARD;
+    return (t / config->interval + 1) * config->interval;
 }
 
 /*
@@ -77,16 +114,22 @@ int ipow(int base, int exp)
 }
 
 /*
- * Returns the 11 bits used index a LLC set in a slice of a given address.
+ * Returns the bits used index a LLC set in a slice of a given address.
  */
 uint64_t get_cache_slice_set_index(ADDR_PTR virt_addr) {
-    // return (virt_addr >> LOG_CACHE_LINESIZE) & CACHE_SETS_L1_MASK;
-    return (virt_addr >> LOG_CACHE_LINESIZE) & (2048-1);
+    return (virt_addr >> LOG_CACHE_LINESIZE) & (geometry.l3_slice_sets - 1);
 }
 
 uint64_t get_L3_cache_set_index(ADDR_PTR virt_addr) {
-    return (virt_addr >> LOG_CACHE_LINESIZE) & CACHE_SETS_L3_MASK;
-    // return (virt_addr >> LOG_CACHE_LINESIZE) & (2048-1);
+    return (virt_addr >> LOG_CACHE_LINESIZE) % geometry.l3_sets;
+}
+
+/*
+ * Returns the n-th line of a buffer with the given LLC slice set index, in
+ * address order. Such lines are the size of a slice apart.
+ */
+ADDR_PTR slice_set_line(const char *buffer, uint64_t set_index, uint64_t n) {
+    return (ADDR_PTR) buffer + (set_index + n * geometry.l3_slice_sets) * CACHE_LINESIZE;
 }
 
 /*
@@ -94,103 +137,293 @@ uint64_t get_L3_cache_set_index(ADDR_PTR virt_addr) {
  */
 // uint64_t get_hugepage_cache_set_index(ADDR_PTR virt_addr)
 // {
-//     return (virt_addr & HUGEPAGE_MASK) >> LOG_CACHE_LINESIZE;
+//     return (virt_addr & (geometry.hugepage_size - 1)) >> LOG_CACHE_LINESIZE;
 // }
 
 
+/*
+ * Fills the eviction set of region k with up to max_slices minimal sets:
+ * those of the profile when they still evict their victims, otherwise the
+ * ones discovered by timing among the n candidates, which are recorded in
+ * the profile. Returns the number of minimal sets.
+ */
+uint32_t find_evset(struct config *config, const char *role, uint32_t k, uint64_t bsize,
+                    uint32_t max_slices, ADDR_PTR *candidates, uint32_t n)
+{
+    struct evset *set = &config->addr_sets[k];
+    uint64_t region = config->cache_regions[k];
+    ADDR_PTR base = (ADDR_PTR) config->buffer;
+
+    const struct profile_evset *saved = profile_evset(&config->profile, role, region);
+    if (saved) {
+        ADDR_PTR *lines = malloc(saved->n * sizeof(ADDR_PTR));
+        bool in_buffer = true;
+        for (uint32_t i = 0; i < saved->n; i++) {
+            in_buffer &= saved->offsets[i] < bsize;
+            lines[i] = base + saved->offsets[i];
+        }
+        uint32_t slices = in_buffer? evset_restore(set, lines, saved->n, config->miss_threshold): 0;
+        free(lines);
+        if (slices) {
+            printf("Restored %u minimal eviction sets for region %lu from the profile\n",
+                   slices, region);
+            return slices;
+        }
+    }
+
+    ADDR_PTR *victims = malloc(max_slices * sizeof(ADDR_PTR));
+    uint32_t slices = evset_discover(set, max_slices, candidates, n,
+                                     config->miss_threshold, victims);
+    if (config->profile_path && slices) {
+        // each minimal set after its victim, in the order they were appended
+        uint32_t group = geometry.l3_ways + 1;
+        uint64_t *offsets = malloc((uint64_t) slices * group * sizeof(uint64_t));
+        ADDR_PTR addr = set->head;
+        for (uint32_t s = 0; s < slices; s++) {
+            offsets[s * group] = victims[s] - base;
+            for (uint32_t i = 1; i < group; i++) {
+                offsets[s * group + i] = addr - base;
+                addr = evset_next(addr);
+            }
+        }
+        profile_set_evset(&config->profile, role, region, offsets, slices * group);
+        free(offsets);
+    }
+    free(victims);
+    return slices;
+}
+
 /*
  * Allocate a buffer of the size as passed-in
  * returns the pointer to the buffer
+ * Huge pages are populated by the kernel in one go. Small pages are left
+ * unbacked (and unreserved) until the lines in use are touched, so a sparse
+ * set of lines only costs the pages that hold them.
  */
 void *allocate_buffer(uint64_t size) {
     void *buffer = MAP_FAILED;
 #ifdef HUGEPAGES
-    buffer = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|HUGEPAGES, -1, 0);
+    buffer = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                  MAP_ANON|MAP_PRIVATE|MAP_POPULATE|HUGEPAGES, -1, 0);
 #endif
 
     if (buffer == MAP_FAILED) {
         fprintf(stderr, "WARNING: allocating non-hugepages\n");
-        buffer = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+        buffer = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                      MAP_ANON|MAP_PRIVATE|MAP_NORESERVE, -1, 0);
     }
     if (buffer == MAP_FAILED) {
         fprintf(stderr, "Failed to allocate buffer!\n");
         exit(-1);
     }
+#ifdef SIMULATOR
+    sim_map(buffer, size, NULL);
+#endif
 
     return buffer;
 }
 
 /*
- * Convert a given ASCII string to a binary string.
- * From:
- * https://stackoverflow.com/questions/41384262/convert-string-to-binary-in-c
+ * Returns the number of lines of the pages the shared file spans.
  */
-char *string_to_binary(char *s)
+static uint64_t shared_file_lines(const char *path)
 {
-    if (s == NULL) return 0; /* no input string */
-
-    size_t len = strlen(s) - 1;
+    struct stat st;
+    if (stat(path, &st) == -1 || st.st_size == 0) {
+        fprintf(stderr, "ERROR: cannot use %s as the shared file (missing or empty)!\n", path);
+        exit(-1);
+    }
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    return (st.st_size + page - 1) / page * page / CACHE_LINESIZE;
+}
 
-    // Each char is one byte (8 bits) and + 1 at the end for null terminator
-    char *binary = malloc(len * 8 + 1);
-    binary[0] = '\0';
+/*
+ * Maps the whole F+R shared file read-only, asking for huge pages where the
+ * file system allows them, and points the set of every region at its line.
+ * Lines are reloaded in an order shuffled with the evset seed, so that the
+ * reloads of an interval do not form a stride the prefetchers pick up.
+ */
+void map_shared_file(struct config *config)
+{
+    int fd = open(config->shared_filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: Failed to Open File\n");
+        exit(-1);
+    }
 
-    for (size_t i = 0; i < len; ++i) {
-        char ch = s[i];
-        for (int j = 7; j >= 0; --j) {
-            if (ch & (1 << j)) {
-                strcat(binary, "1");
-            } else {
-                strcat(binary, "0");
-            }
-        }
+    size_t size = shared_file_lines(config->shared_filename) * CACHE_LINESIZE;
+    config->buffer = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (config->buffer == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Failed to Map Address\n");
+        exit(-1);
     }
+#ifdef MADV_HUGEPAGE
+    madvise(config->buffer, size, MADV_HUGEPAGE);
+#endif
+#ifdef SIMULATOR
+    sim_map(config->buffer, size, config->shared_filename);
+#endif
 
-    return binary;
+    // the shared mapping is read-only, so each set is a single unlinked line
+    for (uint32_t k = 0; k < config->width; k++) {
+        evset_single(&config->addr_sets[k],
+                     (ADDR_PTR) config->buffer + config->cache_regions[k] * CACHE_LINESIZE);
+        config->line_order[k] = k;
+    }
+    uint64_t state = config->evset_seed;
+    for (uint32_t i = config->width - 1; state && i > 0; i--) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint32_t j = state % (i + 1);
+        uint32_t tmp = config->line_order[i];
+        config->line_order[i] = config->line_order[j];
+        config->line_order[j] = tmp;
+    }
+    printf("File mapped at %p (%zu bytes), monitoring %u lines from %lx\n",
+           config->buffer, size, config->width, config->addr_sets[0].head);
 }
 
 /*
- * Convert 8 bit data stream into character and return
+ * Fills msg with size pseudo-random bits from seed, so that both ends of a
+ * benchmark can generate the same message.
  */
-char *conv_msg(char *data, int size, char *msg) {
-    for (int i = 0; i < size; i++) {
-        char _tmp = 0;
+void generate_random_msg(struct bitstream *msg, uint32_t size, uint64_t seed)
+{
+    uint64_t state = seed;
+    bs_reserve(msg, msg->nbits + size);
+    for (uint32_t i = 0; i < size; i += 64) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        bs_push_bits(msg, state, size - i < 64? size - i: 64);
+    }
+}
 
-        for (int j = i * 8; j < ((i + 1) * 8); j++) {
-            _tmp = (_tmp << 1) + data[j] - '0';
-        }
+/*
+ * Builds the benchmark payload and its raw_bits bits on the wire: the payload
+ * is the largest one whose coding with config->fec fits, zero padded.
+ * Returns the payload size in bits.
+ */
+uint32_t benchmark_payload(const struct config *config, uint32_t raw_bits,
+                           struct bitstream *payload, struct bitstream *raw)
+{
+    uint32_t payload_bits = fec_payload_bits(config->fec, raw_bits);
+    generate_random_msg(payload, payload_bits, CHANNEL_BENCHMARK_SEED);
+    fec_encode(config->fec, payload, raw);
+    while (raw->nbits < raw_bits) {
+        bs_push(raw, 0);
+    }
+    return payload_bits;
+}
 
-        msg[i] = _tmp;
+/*
+ * Returns the index of the channel region that monitors the given set index,
+ * or -1 if the set is not part of the channel.
+ */
+int find_region_slot(const struct config *config, uint64_t set_index)
+{
+    for (uint32_t k = 0; k < config->width; k++) {
+        if (config->cache_regions[k] == set_index)
+            return k;
     }
+    return -1;
+}
 
-    msg[size] = '\0';
+/*
+ * Returns the number of bits carried per interval, level_bits per region.
+ */
+uint32_t symbol_bits(const struct config *config)
+{
+    return config->width * config->level_bits;
+}
 
-    return msg;
+/*
+ * Returns the number of slots a frame takes on the wire.
+ */
+uint32_t frame_slots(const struct config *config)
+{
+    uint32_t bits = symbol_bits(config);
+    uint32_t slots = (frame_wire_bits(config->fec) + bits - 1) / bits;
+    return config->manchester? 2 * slots: slots;
 }
 
 /*
- * Appends the given string to the linked list which is pointed to by the given head
+ * Levels are Gray coded, so mistaking a level for its neighbour
+ * only costs a single bit.
  */
-void append_string_to_linked_list(struct Node **head, ADDR_PTR addr)
+uint64_t level_to_bits(uint32_t level)
 {
-    struct Node *current = *head;
+    return level ^ (level >> 1);
+}
 
-    // Create the new node to append to the linked list
-    struct Node *new_node = malloc(sizeof(*new_node));
-    new_node->addr = addr;
-    new_node->next = NULL;
+uint32_t bits_to_level(uint64_t bits)
+{
+    uint32_t level = 0;
+    for (; bits; bits >>= 1) {
+        level ^= bits;
+    }
+    return level;
+}
 
-    // If the linked list is empty, just make the head to be this new node
-    if (current == NULL)
-        *head = new_node;
+/*
+ * Returns the symbol with every region of the channel signalling level.
+ */
+uint64_t level_symbol(uint32_t level, const struct config *config)
+{
+    uint64_t symbol = 0;
+    for (uint32_t k = 0; k < config->width; k++) {
+        symbol |= level_to_bits(level) << (k * config->level_bits);
+    }
+    return symbol;
+}
 
-        // Otherwise, go till the last node and append the new node after it
-    else {
-        while (current->next != NULL)
-            current = current->next;
+/*
+ * Parses a duration into TSC cycles: a plain number is cycles, a number
+ * followed by ns, us or ms is converted with the detected TSC frequency.
+ */
+uint64_t parse_duration(const char *arg)
+{
+    char *unit;
+    double value = strtod(arg, &unit);
+    double scale;
+    if (*unit == '\0' || strcmp(unit, "c") == 0) {
+        scale = 1;
+    } else if (strcmp(unit, "ns") == 0) {
+        scale = tsc_hz() / 1e9;
+    } else if (strcmp(unit, "us") == 0) {
+        scale = tsc_hz() / 1e6;
+    } else if (strcmp(unit, "ms") == 0) {
+        scale = tsc_hz() / 1e3;
+    } else {
+        fprintf(stderr, "ERROR: unknown time unit in %s (cycles, ns, us or ms)!\n", arg);
+        exit(-1);
+    }
+    if (unit == arg || value < 0) {
+        fprintf(stderr, "ERROR: invalid duration %s!\n", arg);
+        exit(-1);
+    }
+    return value * scale + 0.5;
+}
 
-        current->next = new_node;
+/*
+ * Parses a comma separated list of regions (e.g. "0,17,34") into regions,
+ * returns the number of regions parsed.
+ */
+static uint32_t parse_region_list(char *list, uint64_t *regions)
+{
+    uint32_t count = 0;
+    char *token = strtok(list, ",");
+    while (token != NULL) {
+        if (count >= MAX_CHANNEL_WIDTH) {
+            fprintf(stderr, "ERROR: at most %d regions are supported!\n", MAX_CHANNEL_WIDTH);
+            exit(-1);
+        }
+        regions[count++] = strtoull(token, NULL, 0);
+        token = strtok(NULL, ",");
     }
+    return count;
 }
 
 uint64_t print_pid() {
@@ -201,23 +434,55 @@ uint64_t print_pid() {
 
 void print_help() {
     printf("======================= H E L P ===============================\n");
-    printf("-c: (uint 0 to 2) to select a channel\n");
-    printf("-i: (uint) to specify a interval for each bit transmission\n");
-    printf("-p: (uint) to specify a time period for prime (for llc-pp)\n");
-    printf("-a: (uint) to specify a time period for access (for llc-pp)\n");
-    printf("-r: (uint) to specify a LLC cache set to contend on\n");
+    printf("-c: (uint 0 to 3) to select a channel (llc-pp, f+r, l1d-pp, f+f)\n");
+    printf("-i: (time) to specify a interval for each bit transmission\n");
+    printf("-p: (time) to specify a time period for prime (for llc-pp)\n");
+    printf("-a: (time) to specify a time period for access (for llc-pp)\n");
+    printf("    times are in cycles, or in ns, us or ms with that suffix (e.g. 400us)\n");
+    printf("-P: (path) to load the interval and periods from a ccbench profile,\n");
+    printf("    and keep this host's calibration and eviction sets in it\n");
+    printf("-r: (uint[,uint...]) to specify the LLC cache set(s) to contend on\n");
+    printf("-w: (uint) to send that many bits per interval over as many sets\n");
+    printf("-l: (2|4|8) to signal that many eviction levels per set (for pp)\n");
+    printf("-M: to Manchester code the payload (every symbol and its complement)\n");
+    printf("-s: (uint) to seed the eviction set order (0 keeps address order)\n");
+    printf("-e: to discover minimal LLC eviction sets by timing (for llc-pp)\n");
+    printf("-C: to skip latency calibration and use built-in thresholds\n");
+    printf("-k: (serial|chase|zigzag) to time each probed line, or whole sets at once (receiver pp)\n");
+    printf("-F: (none|hamming|conv|rs) to select the forward error correction\n");
+    printf("-m: (path) to specify the shared file, -r lines are within it (for flush+reload)\n");
+    printf("-f: (path) to send that file, - for stdin (sender)\n");
+    printf("-o: (path) to receive into that file, - for stdout (receiver)\n");
+    printf("-A: to transfer the file with retransmissions of lost frames (both sides)\n");
+    printf("-R: (uint[,uint...]) to specify the regions ARQ acknowledgements come back on\n");
+    printf("-W: (uint) to send that many frames per ARQ round\n");
+    printf("-d: (uint) to probe on a thread pinned to that core, decoding on the others (receiver)\n");
     printf("-b: to start benchmark mode (default is chat mode)\n");
+    printf("-B: (name) benchmark mode sharing its bits with ccbench\n");
+    printf("-t: (path) to record per-interval phase timings and probe latencies there\n");
+    printf("-v: to print the detected cache geometry\n");
     printf("-h: to print this message\n");
     printf("===============================================================\n");
 }
 
 void init_default(struct config *config, int argc, char **argv) {
+    // buffer sizes, set indexing and the region range follow the host caches
+    geometry_detect();
 
     config->buffer = NULL;
-    config->addr_set = NULL;
-
-    // Cache region specifies the targeted set
-    config->cache_region = CHANNEL_DEFAULT_REGION;
+    for (uint32_t k = 0; k < MAX_CHANNEL_WIDTH; k++) {
+        evset_reset(&config->addr_sets[k]);
+    }
+    config->evset_seed = CHANNEL_DEFAULT_EVSET_SEED;
+    config->discover_evsets = false;
+
+    // Cache regions specify the targeted sets, one bit per interval each
+    config->cache_regions[0] = CHANNEL_DEFAULT_REGION;
+    config->width = 1;
+    config->levels = 2;
+    config->manchester = false;
+    uint32_t regions_given = 0, width_given = 0;
+    bool new_profile = false;
     // Interval specifies the time used to send a single bit
     config->interval = CHANNEL_DEFAULT_INTERVAL;
 
@@ -228,32 +493,146 @@ void init_default(struct config *config, int argc, char **argv) {
     // Flush+Reload specific paramters:
     config->shared_filename = "shared.txt";
 
+    // Bulk transfer mode instead of chat mode when set
+    config->in_filename = NULL;
+    config->out_filename = NULL;
+
     config->benchmark_mode = false;
+    config->bench_shm_name = NULL;
+    config->profile_path = NULL;
+    memset(&config->profile, 0, sizeof(config->profile));
 
     config->channel = PrimeProbe;
+    config->probe_kernel = ProbeSerial;
+    config->fec = FecNone;
+
+    config->arq = false;
+    config->arq_window = ARQ_DEFAULT_WINDOW;
+    config->reverse = NULL;
+    config->probe_cpu = -1;
+    uint64_t reverse_regions[MAX_CHANNEL_WIDTH];
+    uint32_t reverse_given = 0;
+
+    bool calibrate = true;
+    char *telemetry_path = NULL;
+    bool verbose = false;
 
     int option;
-    while ((option = getopt(argc, argv, "c:i:p:a:r:bh")) != -1) {
+    while ((option = getopt(argc, argv, "c:i:p:a:P:r:w:l:Ms:eCk:F:m:f:o:AR:W:d:bB:t:vh")) != -1) {
         switch (option) {
             case 'c':
-                // value 0,1,2 to select channel
+                // value 0,1,2,3 to select channel
                 config->channel = atoi(optarg);
+                if (config->channel > FlushFlush) {
+                    fprintf(stderr, "ERROR: channel should be within 0 to %d!\n", FlushFlush);
+                    exit(-1);
+                }
                 break;
             case 'i':
-                config->interval = atoi(optarg);
+                config->interval = parse_duration(optarg);
                 break;
             case 'p':
-                config->prime_period = atoi(optarg);
+                config->prime_period = parse_duration(optarg);
                 break;
             case 'a':
-                config->access_period = atoi(optarg);
+                config->access_period = parse_duration(optarg);
+                break;
+            case 'P': {
+                // tuned timing, options after -P override it
+                struct profile *profile = &config->profile;
+                profile->interval = config->interval;
+                profile->prime_period = config->prime_period;
+                profile->access_period = config->access_period;
+                config->profile_path = optarg;
+                new_profile = !profile_read(optarg, profile);
+                config->interval = profile->interval;
+                config->prime_period = profile->prime_period;
+                config->access_period = profile->access_period;
                 break;
+            }
             case 'r':
-                config->cache_region = atoi(optarg);
+                regions_given = parse_region_list(optarg, config->cache_regions);
+                break;
+            case 'w':
+                width_given = atoi(optarg);
+                break;
+            case 'l':
+                config->levels = atoi(optarg);
+                break;
+            case 'M':
+                config->manchester = true;
+                break;
+            case 's':
+                config->evset_seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'e':
+                config->discover_evsets = true;
+                break;
+            case 'C':
+                calibrate = false;
+                break;
+            case 'k':
+                if (strcmp(optarg, "serial") == 0) {
+                    config->probe_kernel = ProbeSerial;
+                } else if (strcmp(optarg, "chase") == 0) {
+                    config->probe_kernel = ProbeChase;
+                } else if (strcmp(optarg, "zigzag") == 0) {
+                    config->probe_kernel = ProbeZigzag;
+                } else {
+                    fprintf(stderr, "ERROR: unknown probe kernel %s!\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'F':
+                if ((int) (config->fec = fec_parse(optarg)) < 0) {
+                    fprintf(stderr, "ERROR: unknown FEC code %s!\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'm':
+                config->shared_filename = optarg;
+                break;
+            case 'f':
+                config->in_filename = optarg;
+                break;
+            case 'o':
+                config->out_filename = optarg;
+                break;
+            case 'A':
+                config->arq = true;
+                break;
+            case 'R':
+                reverse_given = parse_region_list(optarg, reverse_regions);
+                break;
+            case 'W':
+                config->arq_window = atoi(optarg);
+                if (config->arq_window < 1 || config->arq_window > ARQ_MAX_WINDOW) {
+                    fprintf(stderr, "ERROR: ARQ window should be within 1 to %d!\n",
+                            ARQ_MAX_WINDOW);
+                    exit(-1);
+                }
+                break;
+            case 'd':
+                config->probe_cpu = atoi(optarg);
+                if (config->probe_cpu < 0 ||
+                    config->probe_cpu >= sysconf(_SC_NPROCESSORS_CONF)) {
+                    fprintf(stderr, "ERROR: no core %s to probe on!\n", optarg);
+                    exit(-1);
+                }
                 break;
             case 'b':
                 config->benchmark_mode = true;
                 break;
+            case 'B':
+                config->benchmark_mode = true;
+                config->bench_shm_name = optarg;
+                break;
+            case 't':
+                telemetry_path = optarg;
+                break;
+            case 'v':
+                verbose = true;
+                break;
             case '?':
                 fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
             case 'h':
@@ -263,10 +642,146 @@ void init_default(struct config *config, int argc, char **argv) {
         }
     }
 
+    // The slot schedule is counted in intervals
+    if (config->interval == 0) {
+        fprintf(stderr, "ERROR: the bit interval cannot be zero!\n");
+        exit(-1);
+    }
+
+    // Received data going to stdout must not mix with the messages below
+    if (config->out_filename && strcmp(config->out_filename, "-") == 0) {
+        transfer_claim_stdout();
+    }
+    if (new_profile) {
+        printf("No profile at %s yet, it will hold this host's calibration\n",
+               config->profile_path);
+    }
+    if (verbose) {
+        geometry_print();
+    }
+
+    // Resolve the regions of a wide channel, -w spreads them out from the
+    // first region unless they are all listed explicitly with -r
+    uint64_t region_sets = config->channel == L1DPrimeProbe?
+                           geometry.l1_sets: geometry.l3_slice_sets;
+    uint64_t region_stride = CHANNEL_DEFAULT_REGION_STRIDE;
+    if (shared_memory_channel(config->channel)) {
+        // F+R/F+F regions are lines of the shared file, one page apart
+        region_sets = shared_file_lines(config->shared_filename);
+        region_stride = CHANNEL_FR_REGION_STRIDE;
+    }
+    if (regions_given > 1 && width_given && width_given != regions_given) {
+        fprintf(stderr, "ERROR: -w %u does not match the %u regions given!\n",
+                width_given, regions_given);
+        exit(-1);
+    }
+    config->width = regions_given > 1? regions_given: width_given? width_given: 1;
+    if (config->width > MAX_CHANNEL_WIDTH) {
+        fprintf(stderr, "ERROR: channel width should be within 1 to %d!\n", MAX_CHANNEL_WIDTH);
+        exit(-1);
+    }
+    for (uint32_t k = 0; k < config->width; k++) {
+        if (regions_given <= 1) {
+            config->cache_regions[k] = (config->cache_regions[0] +
+                    k * region_stride) % region_sets;
+        }
+        if (config->cache_regions[k] >= region_sets ||
+            find_region_slot(config, config->cache_regions[k]) != (int) k) {
+            fprintf(stderr, "ERROR: region %lu is out of range or duplicated!\n",
+                    config->cache_regions[k]);
+            exit(-1);
+        }
+    }
+
+    // Each region carries log2(levels) bits per interval
+    if (config->levels < 2 || config->levels > MAX_CHANNEL_LEVELS ||
+        (config->levels & (config->levels - 1))) {
+        fprintf(stderr, "ERROR: levels should be a power of two within 2 to %d!\n",
+                MAX_CHANNEL_LEVELS);
+        exit(-1);
+    }
+    config->level_bits = __builtin_ctz(config->levels);
+    if (symbol_bits(config) > 64) {
+        fprintf(stderr, "ERROR: %u regions of %u levels do not fit a 64-bit symbol!\n",
+                config->width, config->levels);
+        exit(-1);
+    }
+
+    // Miss thresholds differ across SKUs, measure them unless told not to
+    struct calibration calib = {
+        .l1_miss_threshold = CHANNEL_L1_MISS_THRESHOLD,
+        .l3_miss_threshold = CHANNEL_L3_MISS_THRESHOLD,
+        .outlier_threshold = shared_memory_channel(config->channel)?
+                             CHANNEL_FR_OUTLIER_THRESHOLD:
+                             CHANNEL_PP_OUTLIER_THRESHOLD,
+        .flush_threshold = CHANNEL_FF_FLUSH_THRESHOLD,
+        .l1_latency = CHANNEL_L1_LATENCY,
+        .llc_latency = CHANNEL_L3_LATENCY,
+        .dram_latency = CHANNEL_DRAM_LATENCY,
+    };
+    // A profile calibrated on this host is reused while a quick check
+    // agrees with it, and updated otherwise
+    struct profile *profile = &config->profile;
+    struct profile_host host;
+    profile_host(&host);
+    bool same_host = profile->calibrated && profile_host_equal(&profile->host, &host);
+    if (!same_host) {
+        profile_free_evsets(profile);       // found on another host
+    }
+    if (calibrate && same_host && tsc_hz_check(profile->tsc_hz) &&
+        calibrate_check(&profile->calib)) {
+        printf("Using the calibration of profile %s\n", config->profile_path);
+        uint64_t flush_threshold = calib.flush_threshold;
+        calib = profile->calib;
+        calib.flush_threshold = flush_threshold;
+        if (config->channel == FlushFlush && profile->calib.flush_threshold) {
+            calib.flush_threshold = profile->calib.flush_threshold;
+        } else if (config->channel == FlushFlush) {
+            calibrate_flush(&calib);
+            profile->calib.flush_threshold = calib.flush_threshold;
+            profile->dirty |= PROFILE_CALIBRATION;
+        }
+    } else if (calibrate) {
+        calibrate_latency(&calib);
+        if (config->channel == FlushFlush) {
+            calibrate_flush(&calib);
+        }
+        if (config->profile_path) {
+            profile->calibrated = true;
+            profile->host = host;
+            profile->tsc_hz = tsc_hz();
+            profile->calib = calib;
+            profile->calib.flush_threshold = config->channel == FlushFlush?
+                                             calib.flush_threshold: 0;
+            profile->dirty |= PROFILE_CALIBRATION;
+        }
+    }
+    config->outlier_threshold = calib.outlier_threshold;
+
     if (config->channel == PrimeProbe || config->channel == L1DPrimeProbe) {
         config->miss_threshold = config->channel == PrimeProbe?
-                                 CHANNEL_L3_MISS_THRESHOLD:
-                                 CHANNEL_L1_MISS_THRESHOLD;
+                                 calib.l3_miss_threshold:
+                                 calib.l1_miss_threshold;
+        // a chased probe only sees the total, each miss adds its penalty
+        config->miss_penalty = config->channel == PrimeProbe?
+                               (double) calib.dram_latency - calib.llc_latency:
+                               (double) calib.llc_latency - calib.l1_latency;
+        if (config->miss_penalty < 1) {
+            config->miss_penalty = 1;
+        }
+        // a sender walking more lines than ways evicts the whole slice set
+        // at every level
+        if (config->channel == PrimeProbe && config->levels > 2 && !config->discover_evsets) {
+            fprintf(stderr, "ERROR: multi-level LLC P+P needs minimal eviction sets (-e)!\n");
+            exit(-1);
+        }
+        // chasing in priming order cascades any partial eviction through
+        // the whole set, so its time only tells an empty set from a full one
+        if (config->probe_kernel == ProbeChase && config->levels > 2) {
+            fprintf(stderr, "ERROR: the chase probe kernel only supports two levels, "
+                    "use zigzag!\n");
+            exit(-1);
+        }
         if (config->interval < config->prime_period + config->access_period) {
             fprintf(stderr, "ERROR: P+P channel bit interval too short!\n");
             exit(-1);
@@ -278,14 +793,73 @@ void init_default(struct config *config, int argc, char **argv) {
 
     // debug("prime %u access %u probe %u\n", config->prime_period, config->access_period, config->probe_period);
 
-    if (config->channel == FlushReload) {
+    // F+F tells a cached line from the time clflush takes instead of a reload
+    if (shared_memory_channel(config->channel)) {
         config->access_period = CHANNEL_FR_DEFAULT_INTERVAL;
         config->access_period = CHANNEL_FR_DEFAULT_PERIOD;
-        config->miss_threshold = CHANNEL_L1_MISS_THRESHOLD;
-        if (config->cache_region > 63) {
-            fprintf(stderr, "ERROR: F+R channel region should be within a 4K page (64lines)!\n");
+        config->miss_threshold = config->channel == FlushFlush?
+                                 calib.flush_threshold:
+                                 calib.l1_miss_threshold;
+        if (config->levels > 2) {
+            fprintf(stderr, "ERROR: F+R and F+F channels only support two levels!\n");
             exit(-1);
         }
     }
 
+    // ARQ acknowledgements come back over regions of their own, by default
+    // the next ones after the forward regions, one bit per region
+    if (config->arq && (config->benchmark_mode || (!config->in_filename && !config->out_filename))) {
+        fprintf(stderr, "ERROR: ARQ only applies to file transfers (-f or -o)!\n");
+        exit(-1);
+    }
+    if (config->arq && config->probe_cpu >= 0) {
+        fprintf(stderr, "ERROR: ARQ acknowledges frames as they come, "
+                "it cannot decode behind a probe thread (-d)!\n");
+        exit(-1);
+    }
+    if (config->arq) {
+        struct config *reverse = malloc(sizeof(*reverse));
+        *reverse = *config;
+        reverse->buffer = NULL;
+        for (uint32_t k = 0; k < MAX_CHANNEL_WIDTH; k++) {
+            evset_reset(&reverse->addr_sets[k]);
+        }
+        reverse->width = reverse_given > 1? reverse_given: config->width;
+        reverse->levels = 2;
+        reverse->level_bits = 1;
+        reverse->profile_path = NULL;
+        reverse->profile.evsets = 0;
+        reverse->arq = false;
+        reverse->reverse = NULL;
+        uint64_t first = reverse_given? reverse_regions[0]:
+                         config->cache_regions[0] + config->width * region_stride;
+        for (uint32_t k = 0; k < reverse->width; k++) {
+            reverse->cache_regions[k] = reverse_given > 1? reverse_regions[k]:
+                                        (first + k * region_stride) % region_sets;
+            if (reverse->cache_regions[k] >= region_sets ||
+                find_region_slot(config, reverse->cache_regions[k]) >= 0 ||
+                find_region_slot(reverse, reverse->cache_regions[k]) != (int) k) {
+                fprintf(stderr, "ERROR: reverse region %lu is out of range, duplicated "
+                        "or used by the forward channel!\n", reverse->cache_regions[k]);
+                exit(-1);
+            }
+        }
+        config->reverse = reverse;
+    }
+
+    // Phase timings of every interval, written out at exit. F+R and F+F have
+    // no prime, the sender works and the receiver measures the whole interval.
+    // The ARQ sender probes the acknowledgements into the same histograms,
+    // which may take more sets than the forward channel.
+    uint32_t telemetry_width = config->width;
+    if (config->reverse && config->reverse->width > telemetry_width) {
+        telemetry_width = config->reverse->width;
+    }
+    if (telemetry_path && shared_memory_channel(config->channel)) {
+        telemetry_init(telemetry_path, telemetry_width, config->interval,
+                       0, config->interval, config->interval);
+    } else if (telemetry_path) {
+        telemetry_init(telemetry_path, telemetry_width, config->interval,
+                       config->prime_period, config->access_period, config->probe_period);
+    }
 }
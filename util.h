@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
 
 
 #ifndef UTIL_H_
@@ -45,13 +46,47 @@ struct state {
 typedef enum _channel {
     PrimeProbe = 0,
     FlushReload,
-    L1DPrimeProbe
+    L1DPrimeProbe,
+    FlushFlush
 } Channel;
 
-struct Node {
-    ADDR_PTR addr;
-    struct Node *next;
-};
+/*
+ * How the P+P receiver times its probe: one serialized measurement per line,
+ * or a single measurement of a pointer chase through the whole set, walked
+ * in the priming direction or against it (zig-zag).
+ */
+typedef enum _probe_kernel {
+    ProbeSerial = 0,
+    ProbeChase,
+    ProbeZigzag
+} ProbeKernel;
+
+/*
+ * Whether the channel signals over the lines of a shared file (F+R, F+F)
+ * rather than over cache sets.
+ */
+static inline bool shared_memory_channel(Channel channel) {
+    return channel == FlushReload || channel == FlushFlush;
+}
+
+#include "geometry.h"
+#include "sim.h"
+#include "evset.h"
+#include "calibrate.h"
+#include "bits.h"
+#include "fec.h"
+#include "frame.h"
+#include "transfer.h"
+#include "arq.h"
+#include "bench.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "stress.h"
+
+// Maximum number of cache regions (one bit each) carried per interval
+#define MAX_CHANNEL_WIDTH 64
+// Maximum number of eviction intensities a region can signal per interval
+#define MAX_CHANNEL_LEVELS 8
 
 /*
  * Execution config of the program, with the variables
@@ -59,73 +94,125 @@ struct Node {
  */
 struct config {
     char *buffer;
-    struct Node *addr_set;
-    uint64_t cache_region;
+    struct evset addr_sets[MAX_CHANNEL_WIDTH];  // one set per cache region
+    uint64_t cache_regions[MAX_CHANNEL_WIDTH];
+    uint32_t width;                             // regions per interval
+    uint32_t levels;                            // eviction intensities per region
+    uint32_t level_bits;                        // log2(levels) bits per region
+    bool manchester;                            // payload symbols followed by complements
+    double level_means[MAX_CHANNEL_WIDTH][MAX_CHANNEL_LEVELS];  // receiver miss counts per level
+    double level_sigma[MAX_CHANNEL_WIDTH];      // receiver miss count noise
+    uint64_t evset_seed;                        // 0 keeps address order
+    bool discover_evsets;                       // find minimal LLC sets by timing
     uint64_t interval;
     uint64_t prime_period;
     uint64_t access_period;
     uint64_t probe_period;
     uint64_t miss_threshold;
+    uint64_t outlier_threshold;                 // samples above are discarded
+    ProbeKernel probe_kernel;
+    double miss_penalty;                        // cycles a miss adds to a chase
     char *shared_filename;
-    bool benchmark_mode;        // sender only
+    uint32_t line_order[MAX_CHANNEL_WIDTH];     // F+R regions in reload order
+    char *in_filename;          // sender only, file to transfer ("-" for stdin)
+    char *out_filename;         // receiver only, file to receive into ("-" for stdout)
+    bool benchmark_mode;
+    char *bench_shm_name;       // ccbench worker, shares the benchmark bits
+    char *profile_path;         // -P, NULL if none
+    struct profile profile;     // timing and calibration kept across runs
     Channel channel;
+    Fec fec;                    // code protecting the payload
+    bool arq;                   // -A, file transfer with retransmissions
+    uint32_t arq_window;        // frames per ARQ round
+    struct config *reverse;     // ARQ acknowledgements, receiver to sender
+    int probe_cpu;              // receiver only, -d core of the probe thread, -1 probes inline
+};
+
+/*
+ * What the receiver measured over a region in one interval.
+ */
+struct region_sample {
+    uint32_t misses;
+    uint32_t samples;                           // valid measurements
+    uint32_t mean_latency;
+    uint32_t min_latency;
+};
+
+/*
+ * A detected symbol with its soft information: llr[b] is the log-likelihood
+ * ratio of bit b of the symbol being a one (positive favours one).
+ */
+struct symbol_sample {
+    uint64_t symbol;                            // hard decision
+    struct region_sample regions[MAX_CHANNEL_WIDTH];
+    float llr[64];
 };
 
+/*
+ * Loads the line at addr, as the channels and the calibration do to bring
+ * it into the caches.
+ */
+static inline __attribute__((always_inline))
+void load_line(ADDR_PTR addr) {
+#ifdef SIMULATOR
+    sim_load(addr);
+#else
+    *(volatile char *) addr;
+#endif
+}
+
 uint64_t measure_one_block_access_time(ADDR_PTR addr);
+uint64_t measure_flush_time(ADDR_PTR addr);
 void clflush(ADDR_PTR addr);
 uint64_t rdtsc();
 CYCLES rdtscp(void);
 
 uint64_t get_time();
-uint64_t cc_sync();
+uint64_t next_slot(const struct config *config);
+uint64_t parse_duration(const char *arg);
 
 uint64_t print_pid();
 void print_help();
 
 int ipow(int base, int exp);
 
-char *string_to_binary(char *s);
-
-char *conv_msg(char *data, int size, char *msg);
-
 
 uint64_t get_cache_slice_set_index(ADDR_PTR virt_addr);
 uint64_t get_L3_cache_set_index(ADDR_PTR virt_addr);
 // uint64_t get_hugepage_cache_set_index(ADDR_PTR virt_addr);
+ADDR_PTR slice_set_line(const char *buffer, uint64_t set_index, uint64_t n);
+uint32_t find_evset(struct config *config, const char *role, uint32_t k, uint64_t bsize,
+                    uint32_t max_slices, ADDR_PTR *candidates, uint32_t n);
 void *allocate_buffer(uint64_t size);
+void map_shared_file(struct config *config);
 
-void append_string_to_linked_list(struct Node **head, ADDR_PTR addr);
+void generate_random_msg(struct bitstream *msg, uint32_t size, uint64_t seed);
+uint32_t benchmark_payload(const struct config *config, uint32_t raw_bits,
+                           struct bitstream *payload, struct bitstream *raw);
+
+int find_region_slot(const struct config *config, uint64_t set_index);
+uint32_t symbol_bits(const struct config *config);
+uint32_t frame_slots(const struct config *config);
+uint64_t level_to_bits(uint32_t level);
+uint32_t bits_to_level(uint64_t bits);
+uint64_t level_symbol(uint32_t level, const struct config *config);
 
 void init_default(struct config *config, int argc, char **argv);
 
+#include "tx.h"
+#include "rx.h"
+#include "pipeline.h"
+
 
 // =======================================
 // Machine Configuration
 // =======================================
 
-// Hugepage
-#define HUGEPAGE_BITS 21
-#define HUGEPAGE_SIZE (1 << HUGEPAGE_BITS)
-#define HUGEPAGE_MASK (HUGEPAGE_SIZE - 1)
-
-// Cache
+// The cache geometry is detected at startup, see geometry.h. Only the line
+// size is fixed, the channel's address arithmetic is built around it.
 #define CACHE_LINESIZE      64
 #define LOG_CACHE_LINESIZE  6
 
-// L1
-#define LOG_CACHE_SETS_L1   6
-#define CACHE_SETS_L1       64
-#define CACHE_SETS_L1_MASK  (CACHE_SETS_L1 - 1)
-#define CACHE_WAYS_L1       8
-#define CACHE_WAYS_L2       8
-
-// LLC
-
-#define LOG_CACHE_SETS_L3   15
-#define CACHE_SETS_L3       32768
-#define CACHE_SETS_L3_MASK  (CACHE_SETS_L3 - 1)
-#define CACHE_WAYS_L3       20
-
 // =======================================
 // Covert Channel Default Configuration
 // =======================================
@@ -134,12 +221,27 @@ void init_default(struct config *config, int argc, char **argv);
 #define CHANNEL_DEFAULT_INTERVAL        0x000f0000
 #define CHANNEL_DEFAULT_PERIOD          0x00050000
 #define CHANNEL_DEFAULT_REGION          0x0
-#define CHANNEL_SYNC_TIMEMASK           0x003fffff
-#define CHANNEL_SYNC_JITTER             0x4000
+#define CHANNEL_DEFAULT_REGION_STRIDE   17      // spacing of regions for -w
+#define CHANNEL_FR_REGION_STRIDE        65      // F+R lines for -w, next page and line
+#define CHANNEL_SENDER_WAY_LINES        2       // LLC sender lines per way of every slice
+#define CHANNEL_DEFAULT_EVSET_SEED      0x2545f4914f6cdd1d
+#define CHANNEL_SLOT_GUARD              0x4000  // setup time before the first slot
+#define CHANNEL_CLOCK_DITHER_FRACTION   64      // early-late offset, fraction of the interval
+#define CHANNEL_CLOCK_GATE_SYMBOLS      128     // symbols per phase update
+#define CHANNEL_CLOCK_DEADBAND          0.05    // relative early-late difference ignored
 #define CHANNEL_L3_MISS_THRESHOLD       220
 #define CHANNEL_L2_MISS_THRESHOLD       150 	// not used
 #define CHANNEL_L1_MISS_THRESHOLD       84
-#define MAX_BUFFER_LEN                  1024
+#define CHANNEL_L1_LATENCY              40      // medians used when not calibrated
+#define CHANNEL_L3_LATENCY              110
+#define CHANNEL_DRAM_LATENCY            300
+#define CHANNEL_PROBE_BASELINE_DECAY    4096    // symbols for an idle set chase to drift up
+#define CHANNEL_PP_OUTLIER_THRESHOLD    800     // used when not calibrated
+#define CHANNEL_FR_OUTLIER_THRESHOLD    1000
+#define CHANNEL_FR_MISS_SIGMA           0.25    // spread of the F+R/F+F miss fraction
+#define CHANNEL_FF_FLUSH_THRESHOLD      150     // clflush of a cached line, when not calibrated
+#define CHANNEL_TRAINING_REPEATS        8       // intervals per level after the preamble
+#define CHANNEL_BENCHMARK_SEED          0x9e3779b97f4a7c15
 
 // TODO: following parameters need to be verified
 #define CHANNEL_FR_DEFAULT_INTERVAL     0x00008000 // (1<<15)